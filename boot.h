@@ -0,0 +1,32 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+struct BootFrame
+{
+	uint16_t type;
+	uint16_t dataSize;
+	uint16_t checksum;
+	size_t offset;
+	size_t length;
+};
+
+struct BootStage
+{
+	const char *name;
+	enum Framing framing;
+	uint32_t address;
+	uint32_t size;
+	const uint8_t *bytes;
+	const struct BootFrame *frames;
+	size_t frameCount;
+};
+
+extern const struct BootStage BootStages[];
+extern const size_t BootStageCount;
+
+#endif
@@ -0,0 +1,473 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "broadcast.h"
+#include "system.h"
+
+struct Slot
+{
+	struct Frame header;
+	uint8_t *buffer;
+	size_t length;
+	unsigned references;
+};
+
+struct Consumer
+{
+	uint64_t next;
+	uint8_t *orphan;
+	double progress;
+	bool holding;
+	bool active;
+	bool joined;
+	bool evicted;
+};
+
+struct Broadcast
+{
+	struct Image *image;
+	enum Framing framing;
+	uint16_t payloadSize;
+	uint32_t remaining;
+	double grace;
+
+	struct Slot slots[BROADCAST_SLOT_COUNT];
+	struct Consumer consumers[BROADCAST_CONSUMER_COUNT];
+	unsigned consumerCount;
+	uint64_t produced;
+
+	pthread_mutex_t lock;
+	pthread_cond_t readable;
+	pthread_cond_t writable;
+	bool finished;
+	bool failed;
+	bool cancelled;
+
+	pthread_t thread;
+	bool running;
+};
+
+static void *produce(void *);
+static bool awaitSlot(struct Broadcast *, struct Slot *);
+static void evictLaggards(struct Broadcast *, struct Slot *);
+static void dropReferences(struct Broadcast *, struct Consumer *);
+static unsigned countActive(struct Broadcast *);
+static unsigned countJoined(struct Broadcast *);
+static void finishBroadcast(struct Broadcast *, bool);
+static void deallocateBroadcast(struct Broadcast *);
+
+struct Broadcast *startBroadcast(struct Image *image, enum Framing framing,
+                                 uint16_t payloadSize, unsigned consumers,
+                                 uint32_t grace)
+{
+	struct Broadcast *broadcast = NULL;
+	int result = 0;
+
+	if (consumers == 0 || consumers > BROADCAST_CONSUMER_COUNT)
+	{
+		ERROR("Invalid consumer count");
+		return NULL;
+	}
+
+	broadcast = calloc(1, sizeof(struct Broadcast));
+
+	if (broadcast == NULL)
+	{
+		ERROR(strerror(errno));
+		return NULL;
+	}
+
+	broadcast->image = image;
+	broadcast->framing = framing;
+	broadcast->payloadSize = payloadSize;
+	broadcast->remaining = getImageSize(image);
+	broadcast->grace = (grace > BROADCAST_GRACE_PERIOD ? grace
+	                    : BROADCAST_GRACE_PERIOD) / 1000.0;
+	broadcast->consumerCount = consumers;
+
+	pthread_mutex_init(&broadcast->lock, NULL);
+	pthread_cond_init(&broadcast->readable, NULL);
+	pthread_cond_init(&broadcast->writable, NULL);
+
+	for (unsigned index = 0; index < consumers; index++)
+	{
+		broadcast->consumers[index].active = true;
+	}
+
+	for (size_t index = 0; index < BROADCAST_SLOT_COUNT; index++)
+	{
+		broadcast->slots[index].buffer =
+			malloc(MAXIMUM_FRAME_SIZE(payloadSize));
+
+		if (broadcast->slots[index].buffer == NULL)
+		{
+			ERROR(strerror(errno));
+			deallocateBroadcast(broadcast);
+			return NULL;
+		}
+	}
+
+	result = pthread_create(&broadcast->thread, NULL, produce, broadcast);
+
+	if (result != 0)
+	{
+		ERROR(strerror(result));
+		deallocateBroadcast(broadcast);
+		return NULL;
+	}
+
+	broadcast->running = true;
+	return broadcast;
+}
+
+void stopBroadcast(struct Broadcast *broadcast)
+{
+	if (broadcast == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&broadcast->lock);
+	broadcast->cancelled = true;
+	pthread_cond_broadcast(&broadcast->writable);
+	pthread_cond_broadcast(&broadcast->readable);
+	pthread_mutex_unlock(&broadcast->lock);
+
+	if (broadcast->running)
+	{
+		pthread_join(broadcast->thread, NULL);
+	}
+
+	deallocateBroadcast(broadcast);
+}
+
+void joinBroadcast(struct Broadcast *broadcast, unsigned consumer)
+{
+	struct Consumer *self = &broadcast->consumers[consumer];
+
+	pthread_mutex_lock(&broadcast->lock);
+
+	if (self->active && !self->joined)
+	{
+		self->joined = true;
+		self->progress = measureTime();
+
+		if (broadcast->produced < BROADCAST_SLOT_COUNT)
+		{
+			for (uint64_t sequence = 0; sequence < broadcast->produced;
+			     sequence++)
+			{
+				broadcast->slots[sequence].references++;
+			}
+		}
+
+		else
+		{
+			self->evicted = true;
+		}
+
+		pthread_cond_broadcast(&broadcast->writable);
+	}
+
+	pthread_mutex_unlock(&broadcast->lock);
+}
+
+int takeBroadcastFrame(struct Broadcast *broadcast, unsigned consumer,
+                       struct Frame *header, uint8_t **buffer, size_t *length)
+{
+	struct Consumer *self = &broadcast->consumers[consumer];
+	struct Slot *slot = NULL;
+
+	pthread_mutex_lock(&broadcast->lock);
+
+	while (self->active && !self->evicted
+	    && self->next == broadcast->produced
+	    && !broadcast->finished && !broadcast->cancelled)
+	{
+		pthread_cond_wait(&broadcast->readable, &broadcast->lock);
+	}
+
+	if (!self->active || !self->joined || self->evicted || broadcast->failed
+	 || self->next == broadcast->produced)
+	{
+		pthread_mutex_unlock(&broadcast->lock);
+		return -1;
+	}
+
+	slot = &broadcast->slots[self->next % BROADCAST_SLOT_COUNT];
+	*header = slot->header;
+	*buffer = slot->buffer;
+	*length = slot->length;
+
+	self->next++;
+	self->holding = true;
+	self->progress = measureTime();
+
+	pthread_mutex_unlock(&broadcast->lock);
+	return 0;
+}
+
+void releaseBroadcastFrame(struct Broadcast *broadcast, unsigned consumer)
+{
+	struct Consumer *self = &broadcast->consumers[consumer];
+
+	pthread_mutex_lock(&broadcast->lock);
+
+	if (self->holding)
+	{
+		self->holding = false;
+		self->progress = measureTime();
+
+		if (self->orphan)
+		{
+			free(self->orphan);
+			self->orphan = NULL;
+		}
+
+		else
+		{
+			broadcast->slots[(self->next - 1) % BROADCAST_SLOT_COUNT]
+				.references--;
+		}
+
+		pthread_cond_broadcast(&broadcast->writable);
+	}
+
+	pthread_mutex_unlock(&broadcast->lock);
+}
+
+void leaveBroadcast(struct Broadcast *broadcast, unsigned consumer)
+{
+	struct Consumer *self = &broadcast->consumers[consumer];
+
+	releaseBroadcastFrame(broadcast, consumer);
+
+	pthread_mutex_lock(&broadcast->lock);
+
+	if (self->active && self->joined && !self->evicted)
+	{
+		dropReferences(broadcast, self);
+	}
+
+	self->active = false;
+	pthread_cond_broadcast(&broadcast->writable);
+	pthread_mutex_unlock(&broadcast->lock);
+}
+
+bool isEvicted(struct Broadcast *broadcast, unsigned consumer)
+{
+	bool evicted = false;
+
+	pthread_mutex_lock(&broadcast->lock);
+	evicted = broadcast->consumers[consumer].evicted;
+	pthread_mutex_unlock(&broadcast->lock);
+
+	return evicted;
+}
+
+static void *produce(void *argument)
+{
+	struct Broadcast *broadcast = argument;
+	uint8_t *data = malloc(broadcast->payloadSize);
+
+	if (data == NULL)
+	{
+		ERROR(strerror(errno));
+		finishBroadcast(broadcast, true);
+		return NULL;
+	}
+
+	while (broadcast->remaining > 0)
+	{
+		struct Frame frame = { .type = DataTransfer, .data = data };
+		uint16_t length = broadcast->payloadSize;
+		struct Slot *slot = NULL;
+		unsigned active = 0;
+
+		if (length > broadcast->remaining)
+		{
+			length = broadcast->remaining;
+		}
+
+		if (readImage(broadcast->image, data, length) != length)
+		{
+			ERROR("Image ended early");
+			free(data);
+			finishBroadcast(broadcast, true);
+			return NULL;
+		}
+
+		pthread_mutex_lock(&broadcast->lock);
+		slot = &broadcast->slots[broadcast->produced % BROADCAST_SLOT_COUNT];
+
+		if (!awaitSlot(broadcast, slot))
+		{
+			pthread_mutex_unlock(&broadcast->lock);
+			break;
+		}
+
+		pthread_mutex_unlock(&broadcast->lock);
+
+		frame.dataSize = length;
+		slot->length = encodeFrame(broadcast->framing, &frame, slot->buffer);
+		slot->header = frame;
+		slot->header.data = NULL;
+
+		pthread_mutex_lock(&broadcast->lock);
+		active = countActive(broadcast);
+		slot->references = countJoined(broadcast);
+		broadcast->produced++;
+		broadcast->remaining -= length;
+		pthread_cond_broadcast(&broadcast->readable);
+		pthread_mutex_unlock(&broadcast->lock);
+
+		if (active == 0)
+		{
+			break;
+		}
+	}
+
+	free(data);
+	finishBroadcast(broadcast, false);
+	return NULL;
+}
+
+static bool awaitSlot(struct Broadcast *broadcast, struct Slot *slot)
+{
+	while (!broadcast->cancelled && countActive(broadcast) > 0
+	    && (slot->references > 0 || countJoined(broadcast) == 0))
+	{
+		struct timespec deadline;
+		long nanoseconds = broadcast->grace * 1e9;
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += nanoseconds / 1000000000L;
+		deadline.tv_nsec += nanoseconds % 1000000000L;
+
+		if (deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		if (pthread_cond_timedwait(&broadcast->writable, &broadcast->lock,
+		                           &deadline) == ETIMEDOUT)
+		{
+			evictLaggards(broadcast, slot);
+		}
+	}
+
+	return !broadcast->cancelled && countActive(broadcast) > 0;
+}
+
+static void evictLaggards(struct Broadcast *broadcast, struct Slot *slot)
+{
+	uint64_t oldest = broadcast->produced - BROADCAST_SLOT_COUNT;
+	double now = measureTime();
+
+	for (unsigned index = 0; index < broadcast->consumerCount; index++)
+	{
+		struct Consumer *consumer = &broadcast->consumers[index];
+		bool holding = consumer->holding && consumer->next == oldest + 1;
+
+		if (!consumer->active || !consumer->joined || consumer->evicted
+		 || (consumer->next > oldest && !holding)
+		 || now - consumer->progress < broadcast->grace)
+		{
+			continue;
+		}
+
+		dropReferences(broadcast, consumer);
+		consumer->evicted = true;
+
+		if (holding)
+		{
+			uint8_t *buffer = malloc(MAXIMUM_FRAME_SIZE(broadcast->payloadSize));
+
+			if (buffer == NULL)
+			{
+				continue;
+			}
+
+			consumer->orphan = slot->buffer;
+			slot->buffer = buffer;
+			slot->references--;
+		}
+	}
+
+	pthread_cond_broadcast(&broadcast->readable);
+}
+
+static void dropReferences(struct Broadcast *broadcast,
+                           struct Consumer *consumer)
+{
+	for (uint64_t sequence = consumer->next; sequence < broadcast->produced;
+	     sequence++)
+	{
+		broadcast->slots[sequence % BROADCAST_SLOT_COUNT].references--;
+	}
+}
+
+static unsigned countActive(struct Broadcast *broadcast)
+{
+	unsigned active = 0;
+
+	for (unsigned index = 0; index < broadcast->consumerCount; index++)
+	{
+		if (broadcast->consumers[index].active
+		 && !broadcast->consumers[index].evicted)
+		{
+			active++;
+		}
+	}
+
+	return active;
+}
+
+static unsigned countJoined(struct Broadcast *broadcast)
+{
+	unsigned joined = 0;
+
+	for (unsigned index = 0; index < broadcast->consumerCount; index++)
+	{
+		if (broadcast->consumers[index].active
+		 && broadcast->consumers[index].joined
+		 && !broadcast->consumers[index].evicted)
+		{
+			joined++;
+		}
+	}
+
+	return joined;
+}
+
+static void finishBroadcast(struct Broadcast *broadcast, bool failed)
+{
+	pthread_mutex_lock(&broadcast->lock);
+	broadcast->finished = true;
+	broadcast->failed = failed;
+	pthread_cond_broadcast(&broadcast->readable);
+	pthread_mutex_unlock(&broadcast->lock);
+}
+
+static void deallocateBroadcast(struct Broadcast *broadcast)
+{
+	for (size_t index = 0; index < BROADCAST_SLOT_COUNT; index++)
+	{
+		free(broadcast->slots[index].buffer);
+	}
+
+	for (size_t index = 0; index < BROADCAST_CONSUMER_COUNT; index++)
+	{
+		free(broadcast->consumers[index].orphan);
+	}
+
+	pthread_mutex_destroy(&broadcast->lock);
+	pthread_cond_destroy(&broadcast->readable);
+	pthread_cond_destroy(&broadcast->writable);
+	free(broadcast);
+}
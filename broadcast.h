@@ -0,0 +1,30 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+#include "image.h"
+
+#define BROADCAST_SLOT_COUNT 64
+#define BROADCAST_CONSUMER_COUNT 8
+#define BROADCAST_GRACE_PERIOD 250
+
+struct Broadcast;
+
+struct Broadcast *startBroadcast(struct Image *image, enum Framing framing,
+                                 uint16_t payloadSize, unsigned consumers,
+                                 uint32_t grace);
+void stopBroadcast(struct Broadcast *broadcast);
+
+void joinBroadcast(struct Broadcast *broadcast, unsigned consumer);
+
+int takeBroadcastFrame(struct Broadcast *broadcast, unsigned consumer,
+                       struct Frame *header, uint8_t **buffer, size_t *length);
+void releaseBroadcastFrame(struct Broadcast *broadcast, unsigned consumer);
+void leaveBroadcast(struct Broadcast *broadcast, unsigned consumer);
+bool isEvicted(struct Broadcast *broadcast, unsigned consumer);
+
+#endif
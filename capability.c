@@ -0,0 +1,224 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capability.h"
+#include "system.h"
+
+static int parseRecord(char *, struct Capabilities *);
+static bool matchRecord(struct Capabilities *, struct Capabilities *, bool);
+static void formatRecord(FILE *, struct Capabilities *);
+
+int loadCapabilities(struct Capabilities *capabilities)
+{
+	char path[PATH_MAX];
+	char line[BUFSIZ];
+	FILE *stream = NULL;
+	struct Capabilities entry;
+	uint32_t flashID = capabilities->geometry.flashID;
+	int result = -1;
+
+	forgetCapabilities(capabilities);
+	capabilities->geometry.flashID = flashID;
+
+	if (locateFile(path, sizeof(path), "USX_CAPABILITIES",
+	               "XDG_CONFIG_HOME", ".config", "capabilities") == -1)
+	{
+		return -1;
+	}
+
+	stream = fopen(path, "r");
+
+	if (stream == NULL)
+	{
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), stream))
+	{
+		if (parseRecord(line, &entry) == 0
+		 && matchRecord(&entry, capabilities, flashID != 0))
+		{
+			*capabilities = entry;
+			capabilities->known = true;
+			result = 0;
+		}
+	}
+
+	fclose(stream);
+	return result;
+}
+
+int storeCapabilities(struct Capabilities *capabilities)
+{
+	char path[PATH_MAX];
+	char temporary[PATH_MAX + 8];
+	char line[BUFSIZ];
+	struct Capabilities entry;
+	FILE *input = NULL;
+	FILE *output = NULL;
+	int descriptor = -1;
+
+	if (locateFile(path, sizeof(path), "USX_CAPABILITIES",
+	               "XDG_CONFIG_HOME", ".config", "capabilities") == -1)
+	{
+		return -1;
+	}
+
+	if (makeDirectories(path) == -1)
+	{
+		return -1;
+	}
+
+	snprintf(temporary, sizeof(temporary), "%s.XXXXXX", path);
+	descriptor = mkstemp(temporary);
+
+	if (descriptor == -1 || (output = fdopen(descriptor, "w")) == NULL)
+	{
+		ERROR(strerror(errno));
+
+		if (descriptor != -1)
+		{
+			close(descriptor);
+			remove(temporary);
+		}
+
+		return -1;
+	}
+
+	input = fopen(path, "r");
+
+	if (input)
+	{
+		while (fgets(line, sizeof(line), input))
+		{
+			if (parseRecord(line, &entry) == 0
+			 && matchRecord(&entry, capabilities, true))
+			{
+				continue;
+			}
+
+			fputs(line, output);
+		}
+
+		fclose(input);
+	}
+
+	formatRecord(output, capabilities);
+
+	if (fclose(output) == EOF || rename(temporary, path) == -1)
+	{
+		ERROR(strerror(errno));
+		remove(temporary);
+		return -1;
+	}
+
+	capabilities->known = true;
+	return 0;
+}
+
+void forgetCapabilities(struct Capabilities *capabilities)
+{
+	memset(&capabilities->geometry, 0, sizeof(capabilities->geometry));
+	memset(capabilities->blockSize, 0, sizeof(capabilities->blockSize));
+	capabilities->latency = 0;
+	capabilities->known = false;
+}
+
+static int parseRecord(char *line, struct Capabilities *entry)
+{
+	unsigned int vendor = 0;
+	unsigned int product = 0;
+	unsigned int blockSize[2] = { 0 };
+	char banner[CAPABILITY_BANNER_SIZE * 2 + 1];
+	int length = 0;
+
+	memset(entry, 0, sizeof(*entry));
+
+	if (sscanf(line, "%x %x %128s %x %x %x %x %x %x %u",
+	           &vendor, &product, banner,
+	           &entry->geometry.flashID, &entry->geometry.pageSize,
+	           &entry->geometry.sectorSize, &entry->geometry.flashSize,
+	           &blockSize[BootROMFraming], &blockSize[FDLFraming],
+	           &entry->latency) != 10)
+	{
+		return -1;
+	}
+
+	if (vendor > UINT16_MAX || product > UINT16_MAX
+	 || blockSize[BootROMFraming] > UINT16_MAX
+	 || blockSize[FDLFraming] > UINT16_MAX)
+	{
+		return -1;
+	}
+
+	entry->vendor = vendor;
+	entry->product = product;
+	entry->blockSize[BootROMFraming] = blockSize[BootROMFraming];
+	entry->blockSize[FDLFraming] = blockSize[FDLFraming];
+
+	if (strcmp(banner, "-") == 0)
+	{
+		return 0;
+	}
+
+	length = strlen(banner);
+
+	if (length % 2)
+	{
+		return -1;
+	}
+
+	for (int index = 0; index < length; index += 2)
+	{
+		unsigned int byte = 0;
+
+		if (sscanf(banner + index, "%2x", &byte) != 1)
+		{
+			return -1;
+		}
+
+		entry->banner[entry->bannerLength++] = byte;
+	}
+
+	return 0;
+}
+
+static bool matchRecord(struct Capabilities *entry,
+                        struct Capabilities *capabilities, bool flash)
+{
+	return entry->vendor == capabilities->vendor
+	    && entry->product == capabilities->product
+	    && entry->bannerLength == capabilities->bannerLength
+	    && memcmp(entry->banner, capabilities->banner,
+	              entry->bannerLength) == 0
+	    && (!flash || entry->geometry.flashID
+	                  == capabilities->geometry.flashID);
+}
+
+static void formatRecord(FILE *stream, struct Capabilities *capabilities)
+{
+	fprintf(stream, "%04x %04x ", capabilities->vendor, capabilities->product);
+
+	if (capabilities->bannerLength == 0)
+	{
+		fputc('-', stream);
+	}
+
+	for (uint16_t index = 0; index < capabilities->bannerLength; index++)
+	{
+		fprintf(stream, "%02x", capabilities->banner[index]);
+	}
+
+	fprintf(stream, " %08x %x %x %x %04x %04x %u\n",
+	        capabilities->geometry.flashID,
+	        capabilities->geometry.pageSize,
+	        capabilities->geometry.sectorSize,
+	        capabilities->geometry.flashSize,
+	        capabilities->blockSize[BootROMFraming],
+	        capabilities->blockSize[FDLFraming],
+	        capabilities->latency);
+}
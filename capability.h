@@ -0,0 +1,38 @@
+#ifndef CAPABILITY_H
+#define CAPABILITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+#define CAPABILITY_BANNER_SIZE 64
+#define CAPABILITY_TIMEOUT_MARGIN 4
+#define CAPABILITY_MINIMUM_TIMEOUT 1000
+
+struct Geometry
+{
+	uint32_t flashID;
+	uint32_t pageSize;
+	uint32_t sectorSize;
+	uint32_t flashSize;
+};
+
+struct Capabilities
+{
+	uint16_t vendor;
+	uint16_t product;
+	uint8_t banner[CAPABILITY_BANNER_SIZE];
+	uint16_t bannerLength;
+
+	struct Geometry geometry;
+	uint16_t blockSize[2];
+	uint32_t latency;
+	bool known;
+};
+
+int loadCapabilities(struct Capabilities *capabilities);
+int storeCapabilities(struct Capabilities *capabilities);
+void forgetCapabilities(struct Capabilities *capabilities);
+
+#endif
@@ -29,18 +29,32 @@ int readCommand(char *buffer, size_t size)
 	return 0;
 }
 
-void parseCommand(struct Command *commands, size_t count, char *cursor)
+struct Command *findCommand(struct Command *commands, size_t count,
+                            char **cursor)
 {
 	for (size_t index = 0; index < count; index++)
 	{
 		struct Command *command = commands + index;
 
-		if (matchToken(&cursor, command->trigger) == 0)
+		if (matchToken(cursor, command->trigger) == 0)
 		{
-			command->function(cursor);
-			return;
+			return command;
 		}
 	}
 
 	fprintf(stderr, "Undefined command\n\n");
+	return NULL;
+}
+
+int parseCommand(struct Command *commands, size_t count, char *cursor)
+{
+	struct Command *command = findCommand(commands, count, &cursor);
+
+	if (command == NULL)
+	{
+		return -1;
+	}
+
+	command->function(cursor);
+	return 0;
 }
@@ -9,6 +9,7 @@ struct Command
 
 void prompt(char *text);
 int readCommand(char *, size_t);
-void parseCommand(struct Command *, size_t, char *);
+struct Command *findCommand(struct Command *, size_t, char **);
+int parseCommand(struct Command *, size_t, char *);
 
 #endif
@@ -0,0 +1,351 @@
+#include <errno.h>
+#include <limits.h>
+#include <openssl/evp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "digest.h"
+
+struct Checksum
+{
+	EVP_MD_CTX *context;
+	uLong crc;
+};
+
+struct Digest
+{
+	char path[PATH_MAX];
+	FILE *manifest;
+	uint32_t address;
+	uint32_t size;
+
+	struct Checksum region;
+	struct Checksum chunk;
+	uint32_t chunkOffset;
+	uint32_t chunkLength;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t readable;
+	pthread_cond_t writable;
+
+	struct Frame *queue[DIGEST_QUEUE_SIZE];
+	size_t head;
+	size_t tail;
+	bool finished;
+	bool failed;
+};
+
+static void *hash(void *);
+static int updateDigest(struct Digest *, uint8_t *, size_t);
+static int emitChunk(struct Digest *);
+static int startChecksum(struct Checksum *);
+static void updateChecksum(struct Checksum *, uint8_t *, size_t);
+static int finishChecksum(struct Checksum *, char *);
+static void deallocateDigest(struct Digest *);
+
+struct Digest *startDigest(char *manifest, uint32_t address, uint32_t size)
+{
+	struct Digest *digest = calloc(1, sizeof(struct Digest));
+	int result = 0;
+
+	if (digest == NULL)
+	{
+		ERROR(strerror(errno));
+		return NULL;
+	}
+
+	digest->address = address;
+	digest->size = size;
+	snprintf(digest->path, sizeof(digest->path), "%s", manifest);
+
+	if (startChecksum(&digest->region) == -1
+	 || startChecksum(&digest->chunk) == -1)
+	{
+		deallocateDigest(digest);
+		return NULL;
+	}
+
+	digest->manifest = fopen(digest->path, "w");
+
+	if (digest->manifest == NULL)
+	{
+		fprintf(stderr, "%s: %s\n\n", digest->path, strerror(errno));
+		deallocateDigest(digest);
+		return NULL;
+	}
+
+	fprintf(digest->manifest, "# chunk OFFSET LENGTH CRC32 SHA256\n"
+	                          "# region ADDRESS SIZE CRC32 SHA256\n");
+
+	pthread_mutex_init(&digest->lock, NULL);
+	pthread_cond_init(&digest->readable, NULL);
+	pthread_cond_init(&digest->writable, NULL);
+
+	result = pthread_create(&digest->thread, NULL, hash, digest);
+
+	if (result != 0)
+	{
+		ERROR(strerror(result));
+		pthread_mutex_destroy(&digest->lock);
+		pthread_cond_destroy(&digest->readable);
+		pthread_cond_destroy(&digest->writable);
+		fclose(digest->manifest);
+		remove(digest->path);
+		digest->manifest = NULL;
+		deallocateDigest(digest);
+		return NULL;
+	}
+
+	return digest;
+}
+
+int feedDigest(struct Digest *digest, struct Frame *frame)
+{
+	bool failed = false;
+
+	pthread_mutex_lock(&digest->lock);
+
+	while (digest->head - digest->tail == DIGEST_QUEUE_SIZE
+	    && !digest->failed)
+	{
+		pthread_cond_wait(&digest->writable, &digest->lock);
+	}
+
+	failed = digest->failed;
+
+	if (!failed)
+	{
+		digest->queue[digest->head++ % DIGEST_QUEUE_SIZE] = frame;
+		pthread_cond_signal(&digest->readable);
+	}
+
+	pthread_mutex_unlock(&digest->lock);
+
+	if (failed)
+	{
+		deallocateFrame(frame);
+		return -1;
+	}
+
+	return 0;
+}
+
+int finishDigest(struct Digest *digest, bool complete)
+{
+	char crc[9];
+	char sha[EVP_MAX_MD_SIZE * 2 + 1];
+	bool failed = false;
+
+	pthread_mutex_lock(&digest->lock);
+	digest->finished = true;
+	pthread_cond_signal(&digest->readable);
+	pthread_mutex_unlock(&digest->lock);
+
+	pthread_join(digest->thread, NULL);
+
+	while (digest->tail != digest->head)
+	{
+		deallocateFrame(digest->queue[digest->tail++ % DIGEST_QUEUE_SIZE]);
+	}
+
+	failed = digest->failed || !complete;
+
+	if (!failed && digest->chunkLength > 0 && emitChunk(digest) == -1)
+	{
+		failed = true;
+	}
+
+	if (!failed)
+	{
+		snprintf(crc, sizeof(crc), "%08lx", digest->region.crc);
+
+		if (finishChecksum(&digest->region, sha) == -1)
+		{
+			failed = true;
+		}
+
+		else
+		{
+			fprintf(digest->manifest, "region %08x %08x %s %s\n",
+			        digest->address, digest->size, crc, sha);
+		}
+	}
+
+	if (fclose(digest->manifest) == EOF)
+	{
+		ERROR(strerror(errno));
+		failed = true;
+	}
+
+	if (failed)
+	{
+		remove(digest->path);
+	}
+
+	digest->manifest = NULL;
+	pthread_mutex_destroy(&digest->lock);
+	pthread_cond_destroy(&digest->readable);
+	pthread_cond_destroy(&digest->writable);
+	deallocateDigest(digest);
+
+	return failed ? -1 : 0;
+}
+
+static void *hash(void *argument)
+{
+	struct Digest *digest = argument;
+
+	for (;;)
+	{
+		struct Frame *frame = NULL;
+		int result = 0;
+
+		pthread_mutex_lock(&digest->lock);
+
+		while (digest->head == digest->tail && !digest->finished)
+		{
+			pthread_cond_wait(&digest->readable, &digest->lock);
+		}
+
+		if (digest->head == digest->tail)
+		{
+			pthread_mutex_unlock(&digest->lock);
+			break;
+		}
+
+		frame = digest->queue[digest->tail % DIGEST_QUEUE_SIZE];
+		pthread_mutex_unlock(&digest->lock);
+
+		result = updateDigest(digest, frame->data, frame->dataSize);
+		deallocateFrame(frame);
+
+		pthread_mutex_lock(&digest->lock);
+		digest->tail++;
+
+		if (result == -1)
+		{
+			digest->failed = true;
+		}
+
+		pthread_cond_signal(&digest->writable);
+		pthread_mutex_unlock(&digest->lock);
+
+		if (result == -1)
+		{
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int updateDigest(struct Digest *digest, uint8_t *data, size_t length)
+{
+	updateChecksum(&digest->region, data, length);
+
+	while (length > 0)
+	{
+		size_t take = DIGEST_CHUNK_SIZE - digest->chunkLength;
+
+		if (take > length)
+		{
+			take = length;
+		}
+
+		updateChecksum(&digest->chunk, data, take);
+		digest->chunkLength += take;
+		data += take;
+		length -= take;
+
+		if (digest->chunkLength == DIGEST_CHUNK_SIZE
+		 && emitChunk(digest) == -1)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int emitChunk(struct Digest *digest)
+{
+	char crc[9];
+	char sha[EVP_MAX_MD_SIZE * 2 + 1];
+
+	snprintf(crc, sizeof(crc), "%08lx", digest->chunk.crc);
+
+	if (finishChecksum(&digest->chunk, sha) == -1)
+	{
+		return -1;
+	}
+
+	fprintf(digest->manifest, "chunk %08x %08x %s %s\n",
+	        digest->chunkOffset, digest->chunkLength, crc, sha);
+
+	digest->chunkOffset += digest->chunkLength;
+	digest->chunkLength = 0;
+
+	return startChecksum(&digest->chunk);
+}
+
+static int startChecksum(struct Checksum *checksum)
+{
+	if (checksum->context == NULL)
+	{
+		checksum->context = EVP_MD_CTX_new();
+
+		if (checksum->context == NULL)
+		{
+			ERROR("Failed to allocate digest");
+			return -1;
+		}
+	}
+
+	if (EVP_DigestInit_ex(checksum->context, EVP_sha256(), NULL) != 1)
+	{
+		ERROR("Failed to initialise digest");
+		return -1;
+	}
+
+	checksum->crc = crc32(0, Z_NULL, 0);
+	return 0;
+}
+
+static void updateChecksum(struct Checksum *checksum,
+                           uint8_t *data, size_t length)
+{
+	EVP_DigestUpdate(checksum->context, data, length);
+	checksum->crc = crc32(checksum->crc, data, length);
+}
+
+static int finishChecksum(struct Checksum *checksum, char *text)
+{
+	uint8_t value[EVP_MAX_MD_SIZE];
+	unsigned int length = 0;
+
+	if (EVP_DigestFinal_ex(checksum->context, value, &length) != 1)
+	{
+		ERROR("Failed to finalise digest");
+		return -1;
+	}
+
+	for (unsigned int index = 0; index < length; index++)
+	{
+		sprintf(text + index * 2, "%02x", value[index]);
+	}
+
+	text[length * 2] = 0;
+	return 0;
+}
+
+static void deallocateDigest(struct Digest *digest)
+{
+	EVP_MD_CTX_free(digest->region.context);
+	EVP_MD_CTX_free(digest->chunk.context);
+	free(digest);
+}
@@ -0,0 +1,18 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+#define DIGEST_CHUNK_SIZE 1048576
+#define DIGEST_QUEUE_SIZE 64
+
+struct Digest;
+
+struct Digest *startDigest(char *manifest, uint32_t address, uint32_t size);
+int feedDigest(struct Digest *digest, struct Frame *frame);
+int finishDigest(struct Digest *digest, bool complete);
+
+#endif
@@ -0,0 +1,205 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "erase.h"
+#include "frame.h"
+
+static size_t subtractRange(struct Range *, struct Range *, struct Range *);
+static size_t mergeRanges(struct Range *, size_t);
+static int compareRanges(const void *, const void *);
+
+void resetEraseMap(struct EraseMap *map)
+{
+	memset(map, 0, sizeof(*map));
+}
+
+void markErased(struct EraseMap *map, uint32_t address, uint32_t size)
+{
+	struct Range ranges[ERASE_RANGE_COUNT + 1];
+	size_t count = map->count;
+
+	if (size == 0)
+	{
+		return;
+	}
+
+	memcpy(ranges, map->ranges, count * sizeof(*ranges));
+	ranges[count].address = address;
+	ranges[count].size = size;
+	count = mergeRanges(ranges, count + 1);
+
+	if (count > ERASE_RANGE_COUNT)
+	{
+		count = ERASE_RANGE_COUNT;
+	}
+
+	memcpy(map->ranges, ranges, count * sizeof(*ranges));
+	map->count = count;
+}
+
+void markWritten(struct EraseMap *map, uint32_t address, uint32_t size)
+{
+	struct Range written = { address, size };
+	struct Range ranges[ERASE_RANGE_COUNT * 2];
+	size_t count = 0;
+
+	if (size == 0)
+	{
+		return;
+	}
+
+	for (size_t index = 0; index < map->count; index++)
+	{
+		count += subtractRange(&map->ranges[index], &written, ranges + count);
+	}
+
+	if (count > ERASE_RANGE_COUNT)
+	{
+		count = ERASE_RANGE_COUNT;
+	}
+
+	memcpy(map->ranges, ranges, count * sizeof(*ranges));
+	map->count = count;
+}
+
+struct Range *planErase(struct EraseMap *map, uint32_t unit,
+                        struct Range *regions, size_t count, bool covered,
+                        size_t *planned)
+{
+	size_t capacity = count + map->count + 1;
+	struct Range *pending = malloc(capacity * sizeof(struct Range));
+	struct Range *remaining = malloc(capacity * sizeof(struct Range));
+
+	if (pending == NULL || remaining == NULL)
+	{
+		ERROR(strerror(errno));
+		free(remaining);
+		free(pending);
+		return NULL;
+	}
+
+	memcpy(pending, regions, count * sizeof(struct Range));
+	count = mergeRanges(pending, count);
+
+	for (size_t index = 0; index < count && covered && unit > 0; index++)
+	{
+		uint64_t start = pending[index].address;
+		uint64_t end = start + pending[index].size;
+
+		start = (start + unit - 1) / unit * unit;
+		end -= end % unit;
+
+		pending[index].address = start;
+		pending[index].size = end > start ? end - start : 0;
+	}
+
+	for (size_t index = 0; index < map->count; index++)
+	{
+		struct Range *swap = pending;
+		size_t length = 0;
+
+		for (size_t piece = 0; piece < count; piece++)
+		{
+			length += subtractRange(&pending[piece], &map->ranges[index],
+			                        remaining + length);
+		}
+
+		pending = remaining;
+		remaining = swap;
+		count = length;
+	}
+
+	free(remaining);
+
+	for (size_t index = 0; index < count && unit > 0; index++)
+	{
+		uint64_t start = pending[index].address;
+		uint64_t end = start + pending[index].size;
+
+		start -= start % unit;
+		end = (end + unit - 1) / unit * unit;
+
+		pending[index].address = start;
+		pending[index].size = end - start;
+	}
+
+	*planned = mergeRanges(pending, count);
+	return pending;
+}
+
+static size_t subtractRange(struct Range *range, struct Range *removed,
+                            struct Range *pieces)
+{
+	uint64_t start = range->address;
+	uint64_t end = start + range->size;
+	uint64_t cutStart = removed->address;
+	uint64_t cutEnd = cutStart + removed->size;
+	size_t count = 0;
+
+	if (cutEnd <= start || cutStart >= end)
+	{
+		pieces[0] = *range;
+		return 1;
+	}
+
+	if (cutStart > start)
+	{
+		pieces[count].address = start;
+		pieces[count].size = cutStart - start;
+		count++;
+	}
+
+	if (cutEnd < end)
+	{
+		pieces[count].address = cutEnd;
+		pieces[count].size = end - cutEnd;
+		count++;
+	}
+
+	return count;
+}
+
+static size_t mergeRanges(struct Range *ranges, size_t count)
+{
+	size_t merged = 0;
+
+	qsort(ranges, count, sizeof(struct Range), compareRanges);
+
+	for (size_t index = 0; index < count; index++)
+	{
+		struct Range *last = merged > 0 ? &ranges[merged - 1] : NULL;
+		uint64_t end = 0;
+
+		if (ranges[index].size == 0)
+		{
+			continue;
+		}
+
+		if (last == NULL
+		 || ranges[index].address > (uint64_t)last->address + last->size)
+		{
+			ranges[merged++] = ranges[index];
+			continue;
+		}
+
+		end = (uint64_t)ranges[index].address + ranges[index].size;
+
+		if (end > (uint64_t)last->address + last->size)
+		{
+			last->size = end - last->address;
+		}
+	}
+
+	return merged;
+}
+
+static int compareRanges(const void *left, const void *right)
+{
+	const struct Range *first = left;
+	const struct Range *second = right;
+
+	return (first->address > second->address)
+	     - (first->address < second->address);
+}
@@ -0,0 +1,31 @@
+#ifndef ERASE_H
+#define ERASE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ERASE_RANGE_COUNT 64
+#define ERASE_SECTOR_TIMEOUT 400
+
+struct Range
+{
+	uint32_t address;
+	uint32_t size;
+};
+
+struct EraseMap
+{
+	struct Range ranges[ERASE_RANGE_COUNT];
+	size_t count;
+};
+
+void resetEraseMap(struct EraseMap *map);
+void markErased(struct EraseMap *map, uint32_t address, uint32_t size);
+void markWritten(struct EraseMap *map, uint32_t address, uint32_t size);
+
+struct Range *planErase(struct EraseMap *map, uint32_t unit,
+                        struct Range *regions, size_t count, bool covered,
+                        size_t *planned);
+
+#endif
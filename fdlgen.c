@@ -0,0 +1,259 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+
+struct Record
+{
+	uint16_t type;
+	uint16_t dataSize;
+	uint16_t checksum;
+	size_t offset;
+	size_t length;
+};
+
+struct Stage
+{
+	char *name;
+	char *framing;
+	uint32_t address;
+	uint32_t size;
+	struct Record *records;
+	size_t frameCount;
+};
+
+static int generateStage(size_t, struct Stage *, char *, uint16_t);
+static int emitFrame(enum Framing, struct Frame *, struct Stage *);
+static uint8_t *readFile(char *, uint32_t *);
+
+int main(int argc, char *argv[])
+{
+	struct Stage *stages = NULL;
+	size_t count = (argc - 2) / 3;
+	unsigned long blockSize = 0;
+	char *end = NULL;
+
+	if (argc < 5 || (argc - 2) % 3)
+	{
+		fprintf(stderr, "Usage: %s BLOCKSIZE FRAMING ADDRESS FILE...\n\n",
+		        argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	blockSize = strtoul(argv[1], &end, 0);
+
+	if (*end || blockSize == 0 || blockSize > UINT16_MAX)
+	{
+		fprintf(stderr, "Invalid block size\n\n");
+		return EXIT_FAILURE;
+	}
+
+	stages = calloc(count, sizeof(struct Stage));
+
+	if (stages == NULL)
+	{
+		ERROR(strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	printf("#include \"boot.h\"\n");
+
+	for (size_t index = 0; index < count; index++)
+	{
+		struct Stage *stage = &stages[index];
+		char **arguments = argv + 2 + index * 3;
+
+		stage->framing = arguments[0];
+		stage->address = strtoul(arguments[1], &end, 0);
+
+		if (*end || (strcmp(stage->framing, "bootrom")
+		          && strcmp(stage->framing, "fdl")))
+		{
+			fprintf(stderr, "Invalid stage %s %s\n\n",
+			        arguments[0], arguments[1]);
+			return EXIT_FAILURE;
+		}
+
+		if (generateStage(index, stage, arguments[2], blockSize) == -1)
+		{
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("\nconst struct BootStage BootStages[] =\n{\n");
+
+	for (size_t index = 0; index < count; index++)
+	{
+		struct Stage *stage = &stages[index];
+
+		printf("\t{ \"%s\", %s, 0x%08x, 0x%08x, Stage%zuBytes, "
+		       "Stage%zuFrames, %zu },\n",
+		       stage->name,
+		       strcmp(stage->framing, "fdl") ? "BootROMFraming"
+		                                     : "FDLFraming",
+		       stage->address, stage->size, index, index,
+		       stage->frameCount);
+	}
+
+	printf("};\n\nconst size_t BootStageCount = %zu;\n", count);
+	free(stages);
+	return EXIT_SUCCESS;
+}
+
+static int generateStage(size_t index, struct Stage *stage,
+                         char *filename, uint16_t blockSize)
+{
+	enum Framing framing = strcmp(stage->framing, "fdl") ? BootROMFraming
+	                                                     : FDLFraming;
+	uint8_t *contents = readFile(filename, &stage->size);
+	uint32_t header[2];
+	int result = 0;
+
+	struct Frame frame = { 0 };
+
+	if (contents == NULL)
+	{
+		return -1;
+	}
+
+	stage->name = strdup(basename(filename));
+
+	printf("\nstatic const uint8_t Stage%zuBytes[] =\n{", index);
+
+	header[0] = htonl(stage->address);
+	header[1] = htonl(stage->size);
+	frame = (struct Frame) { StartDataTransfer, sizeof(header),
+	                         (uint8_t *)header };
+	result |= emitFrame(framing, &frame, stage);
+
+	for (uint32_t position = 0; position < stage->size;
+	     position += blockSize)
+	{
+		uint32_t length = stage->size - position;
+
+		if (length > blockSize)
+		{
+			length = blockSize;
+		}
+
+		frame = (struct Frame) { DataTransfer, length, contents + position };
+		result |= emitFrame(framing, &frame, stage);
+	}
+
+	frame = (struct Frame) { EndDataTransfer };
+	result |= emitFrame(framing, &frame, stage);
+
+	frame = (struct Frame) { ExecuteData };
+	result |= emitFrame(framing, &frame, stage);
+
+	printf("\n};\n");
+	free(contents);
+
+	if (result != 0)
+	{
+		return -1;
+	}
+
+	printf("\nstatic const struct BootFrame Stage%zuFrames[] =\n{\n", index);
+
+	for (size_t frame = 0; frame < stage->frameCount; frame++)
+	{
+		struct Record *record = &stage->records[frame];
+
+		printf("\t{ 0x%04x, 0x%04x, 0x%04x, %zu, %zu },\n",
+		       record->type, record->dataSize, record->checksum,
+		       record->offset, record->length);
+	}
+
+	printf("};\n");
+	free(stage->records);
+	return 0;
+}
+
+static int emitFrame(enum Framing framing, struct Frame *frame,
+                     struct Stage *stage)
+{
+	static uint8_t buffer[MAXIMUM_FRAME_SIZE(UINT16_MAX)];
+	struct Record *records = NULL;
+	struct Record *record = NULL;
+	size_t length = encodeFrame(framing, frame, buffer);
+	size_t offset = 0;
+
+	records = realloc(stage->records,
+	                  (stage->frameCount + 1) * sizeof(struct Record));
+
+	if (records == NULL)
+	{
+		ERROR(strerror(errno));
+		return -1;
+	}
+
+	if (stage->frameCount > 0)
+	{
+		record = &records[stage->frameCount - 1];
+		offset = record->offset + record->length;
+	}
+
+	record = &records[stage->frameCount++];
+	record->type = frame->type;
+	record->dataSize = frame->dataSize;
+	record->checksum = frame->checksum;
+	record->offset = offset;
+	record->length = length;
+	stage->records = records;
+
+	for (size_t index = 0; index < length; index++)
+	{
+		printf("%s0x%02x,", (offset + index) % 12 ? " " : "\n\t",
+		       buffer[index]);
+	}
+
+	return 0;
+}
+
+static uint8_t *readFile(char *filename, uint32_t *size)
+{
+	FILE *stream = fopen(filename, "r");
+	uint8_t *contents = NULL;
+	long length = 0;
+
+	if (stream == NULL)
+	{
+		fprintf(stderr, "%s: %s\n\n", filename, strerror(errno));
+		return NULL;
+	}
+
+	if (fseek(stream, 0, SEEK_END) == -1
+	 || (length = ftell(stream)) == -1
+	 || fseek(stream, 0, SEEK_SET) == -1)
+	{
+		fprintf(stderr, "%s: %s\n\n", filename, strerror(errno));
+		fclose(stream);
+		return NULL;
+	}
+
+	contents = malloc(length ? length : 1);
+
+	if (contents == NULL)
+	{
+		ERROR(strerror(errno));
+		fclose(stream);
+		return NULL;
+	}
+
+	if (fread(contents, 1, length, stream) != length)
+	{
+		fprintf(stderr, "%s: Short read\n\n", filename);
+		free(contents);
+		fclose(stream);
+		return NULL;
+	}
+
+	fclose(stream);
+	*size = length;
+	return contents;
+}
@@ -5,52 +5,58 @@
 #include <string.h>
 
 #include "frame.h"
+#include "probes.h"
 
-static void checkBootROMData(uint8_t *data, size_t length, uint16_t *checksum)
+PROBE_SEMAPHORE(frame_encode);
+PROBE_SEMAPHORE(frame_decode);
+PROBE_SEMAPHORE(checksum);
+PROBE_SEMAPHORE(checksum_encode);
+
+static const uint16_t BootROMLookup[] =
 {
-	static uint16_t lookup[] =
-	{
-		0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
-		0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
-		0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
-		0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
-		0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
-		0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
-		0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
-		0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
-	
-		0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
-		0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
-		0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
-		0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
-		0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
-		0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
-		0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
-		0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
-	
-		0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
-		0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
-		0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
-		0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
-		0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
-		0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
-		0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
-		0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
-	
-		0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
-		0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
-		0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
-		0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
-		0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
-		0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
-		0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
-		0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
-	};
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+	0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+	0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+	0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+	0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+
+	0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+	0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+	0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+	0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+	0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+	0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+	0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+
+	0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+	0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+	0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+	0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+	0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+
+	0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+	0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+	0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+	0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+	0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+	0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+	0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+};
 
+static void checkBootROMData(uint8_t *data, size_t length, uint16_t *checksum)
+{
 	for (size_t index = 0; index < length; index++)
 	{
 		uint8_t byte = data[index];
-		*checksum = (*checksum << 8) ^ lookup[*checksum >> 8 ^ byte];
+		*checksum = (*checksum << 8) ^ BootROMLookup[*checksum >> 8 ^ byte];
 	}
 }
 
@@ -101,19 +107,21 @@ static void checkFDLFrame(struct Frame *frame)
 	frame->checksum = checksum;
 }
 
-static void (*checkFrame)(struct Frame *) = checkBootROMFrame;
-
-void selectBootROMFraming(void)
+static void checkFrame(enum Framing framing, struct Frame *frame)
 {
-	checkFrame = checkBootROMFrame;
-}
+	switch (framing)
+	{
+		case BootROMFraming:
+			checkBootROMFrame(frame);
+			break;
 
-void selectFDLFraming(void)
-{
-	checkFrame = checkFDLFrame;
+		case FDLFraming:
+			checkFDLFrame(frame);
+			break;
+	}
 }
 
-static void serialiseByte(uint8_t byte, uint8_t **cursor)
+static inline void serialiseByte(uint8_t byte, uint8_t **cursor)
 {
 	if (byte == 0x7d || byte == 0x7e)
 	{
@@ -127,56 +135,102 @@ static void serialiseByte(uint8_t byte, uint8_t **cursor)
 	}
 }
 
-static void serialiseUInt16(uint16_t integer, uint8_t **cursor)
+static inline void serialiseUInt16(uint16_t integer, uint8_t **cursor)
 {
 	serialiseByte(integer >> 8, cursor);
 	serialiseByte(integer, cursor);
 }
 
-static void serialiseData(uint8_t *data, uint16_t dataSize, uint8_t **cursor)
+static size_t serialiseBootROMFrame(struct Frame *frame, uint8_t *buffer)
 {
-	for (size_t index = 0; index < dataSize; index++)
+	uint8_t *cursor = buffer;
+	uint8_t *data = frame->data;
+	uint8_t header[] =
 	{
-		serialiseByte(data[index], cursor);
-	}
-}
+		frame->type     >> 8, frame->type,
+		frame->dataSize >> 8, frame->dataSize
+	};
 
-static void serialiseChecksum(struct Frame *frame, uint8_t **cursor)
-{
-	checkFrame(frame);
-	serialiseUInt16(frame->checksum, cursor);
-}
+	uint16_t checksum = 0;
 
-static int serialiseFrame(struct Frame *frame, uint8_t **buffer, int *length)
-{
-	uint8_t *cursor = NULL;
+	*cursor++ = FRAME_DELIMITER;
 
-	if (frame == NULL)
+	for (size_t index = 0; index < sizeof(header); index++)
 	{
-		ERROR("NULL frame");
-		*length = 0;
-		return -1;
+		serialiseByte(header[index], &cursor);
 	}
 
-	*buffer = calloc(1, (MINIMUM_FRAME_SIZE + frame->dataSize) * 2);
-	cursor = *buffer;
+	checkBootROMData(header, sizeof(header), &checksum);
 
-	if (cursor == NULL)
+	for (size_t index = 0; index < frame->dataSize; index++)
 	{
-		ERROR(strerror(errno));
-		*length = 0;
-		return -1;
+		uint8_t byte = data[index];
+		checksum = (checksum << 8) ^ BootROMLookup[checksum >> 8 ^ byte];
+		serialiseByte(byte, &cursor);
 	}
 
+	frame->checksum = checksum;
+	serialiseUInt16(checksum, &cursor);
+	*cursor++ = FRAME_DELIMITER;
+
+	return cursor - buffer;
+}
+
+static size_t serialiseFDLFrame(struct Frame *frame, uint8_t *buffer)
+{
+	uint8_t *cursor = buffer;
+	uint8_t *data = frame->data;
+	uint32_t checksum = frame->type + frame->dataSize;
+	size_t index = 0;
+
 	*cursor++ = FRAME_DELIMITER;
 	serialiseUInt16(frame->type, &cursor);
 	serialiseUInt16(frame->dataSize, &cursor);
-	serialiseData(frame->data, frame->dataSize, &cursor);
-	serialiseChecksum(frame, &cursor);
+
+	for (index = 0; index + 1 < frame->dataSize; index += 2)
+	{
+		uint8_t high = data[index];
+		uint8_t low  = data[index + 1];
+
+		checksum += (high << 8) | low;
+		serialiseByte(high, &cursor);
+		serialiseByte(low, &cursor);
+	}
+
+	if (index < frame->dataSize)
+	{
+		checksum += data[index];
+		serialiseByte(data[index], &cursor);
+	}
+
+	checksum  = (checksum >> 16) + (checksum & 0xffff);
+	checksum += (checksum >> 16);
+	frame->checksum = ~checksum & 0xffff;
+
+	serialiseUInt16(frame->checksum, &cursor);
 	*cursor++ = FRAME_DELIMITER;
 
-	*length = cursor - *buffer;
-	return 0;
+	return cursor - buffer;
+}
+
+size_t encodeFrame(enum Framing framing, struct Frame *frame, uint8_t *buffer)
+{
+	size_t length = 0;
+
+	switch (framing)
+	{
+		case BootROMFraming:
+			length = serialiseBootROMFrame(frame, buffer);
+			break;
+
+		case FDLFraming:
+			length = serialiseFDLFrame(frame, buffer);
+			break;
+	}
+
+	PROBE3(checksum_encode, framing, frame->type, frame->checksum);
+	PROBE3(frame_encode, frame->type, frame->dataSize, length);
+	return length;
 }
 
 static void deserialiseByte(uint8_t **cursor, uint8_t *byte)
@@ -207,7 +261,17 @@ static void deserialiseData(uint8_t **cursor, uint16_t dataSize, uint8_t *data)
 	}
 }
 
-static int deserialiseFrame(uint8_t *buffer, int length, struct Frame **frame)
+static void discardFrame(struct Frame *frame, struct Frame *storage)
+{
+	if (frame != storage)
+	{
+		deallocateFrame(frame);
+	}
+}
+
+static int deserialiseFrame(enum Framing *framing, bool detect,
+                            uint8_t *buffer, int length,
+                            struct Frame **frame, struct Frame *storage)
 {
 	uint16_t checksum = 0;
 	uint8_t *cursor = buffer;
@@ -230,7 +294,12 @@ static int deserialiseFrame(uint8_t *buffer, int length, struct Frame **frame)
 		return -1;
 	}
 
-	*frame = calloc(1, sizeof(struct Frame));
+	if (storage)
+	{
+		memset(storage, 0, sizeof(*storage));
+	}
+
+	*frame = storage ? storage : calloc(1, sizeof(struct Frame));
 
 	if (*frame == NULL)
 	{
@@ -246,42 +315,77 @@ static int deserialiseFrame(uint8_t *buffer, int length, struct Frame **frame)
 		if ((*frame)->dataSize > length - MINIMUM_FRAME_SIZE)
 		{
 			ERROR("Data underflow");
-			deallocateFrame(*frame);
+			discardFrame(*frame, storage);
 			return -1;
 		}
 
-		(*frame)->data = calloc(1, (*frame)->dataSize);
+		(*frame)->data = storage ? buffer : calloc(1, (*frame)->dataSize);
 
 		if ((*frame)->data == NULL)
 		{
 			ERROR(strerror(errno));
-			deallocateFrame(*frame);
+			discardFrame(*frame, storage);
 			return -1;
 		}
 
 		deserialiseData(&cursor, (*frame)->dataSize, (*frame)->data);
 	}
 
-	checkFrame(*frame);
+	checkFrame(*framing, *frame);
 	deserialiseUInt16(&cursor, &checksum);
 
+	if (checksum != (*frame)->checksum && detect)
+	{
+		enum Framing other = *framing == BootROMFraming ? FDLFraming
+		                                                : BootROMFraming;
+
+		(*frame)->checksum = 0;
+		checkFrame(other, *frame);
+
+		if (checksum == (*frame)->checksum)
+		{
+			*framing = other;
+		}
+	}
+
+	PROBE4(checksum, *framing, (*frame)->type, checksum, (*frame)->checksum);
+
 	if (checksum != (*frame)->checksum)
 	{
 		ERROR("checksum mismatch");
-		deallocateFrame(*frame);
+		discardFrame(*frame, storage);
 		return -1;
 	}
 
 	if (*cursor != FRAME_DELIMITER)
 	{
 		ERROR("Missing last FRAME_DELIMITER");
-		deallocateFrame(*frame);
+		discardFrame(*frame, storage);
 		return -1;
 	}
 
+	PROBE3(frame_decode, (*frame)->type, (*frame)->dataSize, length);
 	return 0;
 }
 
+int decodeFrame(enum Framing framing, uint8_t *buffer, int length,
+                struct Frame **frame)
+{
+	return deserialiseFrame(&framing, false, buffer, length, frame, NULL);
+}
+
+int recogniseFrame(enum Framing *framing, uint8_t *buffer, int length,
+                   struct Frame **frame)
+{
+	return deserialiseFrame(framing, true, buffer, length, frame, NULL);
+}
+
+int recogniseFrameInPlace(enum Framing *framing, uint8_t *buffer, int length,
+                          struct Frame *frame)
+{
+	return deserialiseFrame(framing, true, buffer, length, &frame, frame);
+}
+
 void deallocateFrame(struct Frame *frame)
 {
 	if (frame)
@@ -295,39 +399,8 @@ void deallocateFrame(struct Frame *frame)
 	}
 }
 
-int transmitFrame(struct Frame *frame, int (*tx)(uint8_t *, size_t))
-{
-	int result = 0;
-	int length = 0;
-	uint8_t *buffer = NULL;
-
-	if (serialiseFrame(frame, &buffer, &length) == -1)
-	{
-		return -1;
-	}
-
-	result = tx(buffer, length);
-	free(buffer);
-	return result;
-}
-
-int receiveFrame(int (*rx)(uint8_t *, size_t, int *), struct Frame **frame)
-{
-	int length = 0;
-	uint8_t buffer[BUFSIZ];
-
-	if (rx(buffer, sizeof(buffer), &length) == -1)
-	{
-		return -1;
-	}
-
-	return deserialiseFrame(buffer, length, frame);
-}
-
-void dumpFrame(struct Frame *frame)
+char *labelFrameType(uint16_t type)
 {
-	char *label = "Unknown";
-
 	static char *frameTypeLabels[] =
 	{
 		[Connect]             = "Connect",
@@ -350,14 +423,28 @@ void dumpFrame(struct Frame *frame)
 		[VerificationFailure] = "Verification Failure"
 	};
 
-	if (frame)
+	static const size_t count = sizeof(frameTypeLabels)
+	                          / sizeof(*frameTypeLabels);
+
+	if (type < count && frameTypeLabels[type] != NULL)
 	{
-		if (frameTypeLabels[frame->type] != NULL)
-		{
-			label = frameTypeLabels[frame->type];
-		}
+		return frameTypeLabels[type];
+	}
 
-		printf("  Frame Type:    %04x (%s)\n", frame->type, label);
+	return "Unknown";
+}
+
+char *labelFraming(enum Framing framing)
+{
+	return framing == FDLFraming ? "fdl" : "bootrom";
+}
+
+void dumpFrame(struct Frame *frame)
+{
+	if (frame)
+	{
+		printf("  Frame Type:    %04x (%s)\n", frame->type,
+		                                       labelFrameType(frame->type));
 		printf("  Data Size:     %04x\n",   frame->dataSize);
 		printf("  Checksum:      %04x\n\n", frame->checksum);
 	}
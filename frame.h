@@ -8,6 +8,7 @@
 
 #define FRAME_DELIMITER '~' 
 #define MINIMUM_FRAME_SIZE 8
+#define MAXIMUM_FRAME_SIZE(dataSize) ((MINIMUM_FRAME_SIZE + (dataSize)) * 2)
 
 struct Frame
 {
@@ -17,6 +18,12 @@ struct Frame
 	uint16_t  checksum;
 };
 
+enum Framing
+{
+	BootROMFraming,
+	FDLFraming
+};
+
 enum FrameType
 {
 	Connect             = 0x00,
@@ -39,13 +46,17 @@ enum FrameType
 	VerificationFailure = 0xa6
 };
 
-void selectBootROMFraming(void);
-void selectFDLFraming(void);
-
-int transmitFrame(struct Frame *frame, int (*tx)(uint8_t *, size_t));
-int receiveFrame(int (*rx)(uint8_t *, size_t, int *), struct Frame **frame);
+size_t encodeFrame(enum Framing framing, struct Frame *frame, uint8_t *buffer);
+int decodeFrame(enum Framing framing, uint8_t *buffer, int length,
+                struct Frame **frame);
+int recogniseFrame(enum Framing *framing, uint8_t *buffer, int length,
+                   struct Frame **frame);
+int recogniseFrameInPlace(enum Framing *framing, uint8_t *buffer, int length,
+                          struct Frame *frame);
 
 void deallocateFrame(struct Frame *frame);
+char *labelFrameType(uint16_t type);
+char *labelFraming(enum Framing framing);
 void dumpFrame(struct Frame *frame);
 
 #endif
@@ -0,0 +1,500 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "hotplug.h"
+#include "simulator.h"
+#include "system.h"
+
+struct Waiter
+{
+	uint16_t vendor;
+	uint16_t product;
+	struct Arrival arrival;
+	int arrived;
+};
+
+struct Timer
+{
+	pthread_t thread;
+	struct Arrival arrival;
+	double deadline;
+	bool used;
+	bool finished;
+};
+
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Changed = PTHREAD_COND_INITIALIZER;
+
+static struct Waiter *Waiters[HOTPLUG_WAITER_COUNT];
+static size_t WaiterCount = 0;
+static struct Arrival Pending[HOTPLUG_PENDING_COUNT];
+static size_t PendingCount = 0;
+static libusb_device *Held[HOTPLUG_DEVICE_COUNT];
+static size_t HeldCount = 0;
+static struct Timer Timers[HOTPLUG_TIMER_COUNT];
+
+static bool Registered = false;
+static bool Stopping = false;
+static libusb_hotplug_callback_handle Callback;
+
+static int LIBUSB_CALL receiveHotplug(libusb_context *, libusb_device *,
+                                      libusb_hotplug_event, void *);
+static void *runTimer(void *);
+static void dispatchArrival(struct Waiter *, struct Arrival *);
+static bool matchArrival(struct Waiter *, struct Arrival *);
+static bool takePending(struct Waiter *);
+static bool scanDevices(struct Waiter *);
+static void removeWaiter(struct Waiter *);
+static void withdrawDevice(libusb_device *);
+static void addHeld(libusb_device *);
+static bool isHeld(libusb_device *);
+static void waitForChange(double);
+
+void startHotplug(void)
+{
+	int result = 0;
+
+	Stopping = false;
+
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+	{
+		return;
+	}
+
+	result = libusb_hotplug_register_callback(NULL,
+	                                          LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED
+	                                        | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+	                                          LIBUSB_HOTPLUG_NO_FLAGS,
+	                                          LIBUSB_HOTPLUG_MATCH_ANY,
+	                                          LIBUSB_HOTPLUG_MATCH_ANY,
+	                                          LIBUSB_HOTPLUG_MATCH_ANY,
+	                                          receiveHotplug, NULL, &Callback);
+	Registered = result == LIBUSB_SUCCESS;
+}
+
+void stopHotplug(void)
+{
+	pthread_mutex_lock(&Lock);
+	Stopping = true;
+	pthread_cond_broadcast(&Changed);
+	pthread_mutex_unlock(&Lock);
+
+	for (size_t index = 0; index < HOTPLUG_TIMER_COUNT; index++)
+	{
+		if (Timers[index].used)
+		{
+			pthread_join(Timers[index].thread, NULL);
+			Timers[index].used = false;
+		}
+	}
+
+	if (Registered)
+	{
+		libusb_hotplug_deregister_callback(NULL, Callback);
+		Registered = false;
+	}
+
+	pthread_mutex_lock(&Lock);
+
+	for (size_t index = 0; index < PendingCount; index++)
+	{
+		discardArrival(&Pending[index]);
+	}
+
+	PendingCount = 0;
+	HeldCount = 0;
+	pthread_mutex_unlock(&Lock);
+}
+
+int awaitArrival(uint16_t vendor, uint16_t product, uint32_t timeout,
+                 atomic_bool *cancelled, struct Arrival *arrival)
+{
+	struct Waiter waiter = { .vendor = vendor, .product = product };
+	double start = measureTime();
+	int result = 0;
+
+	pthread_mutex_lock(&Lock);
+
+	if (!takePending(&waiter) && !scanDevices(&waiter))
+	{
+		if (WaiterCount == HOTPLUG_WAITER_COUNT)
+		{
+			pthread_mutex_unlock(&Lock);
+			fprintf(stderr, "Too many waiting sessions\n\n");
+			return -1;
+		}
+
+		Waiters[WaiterCount++] = &waiter;
+	}
+
+	while (!waiter.arrived)
+	{
+		double period = HOTPLUG_POLL_PERIOD / 1000.0;
+		double elapsed = measureTime() - start;
+
+		if (Stopping || atomic_exchange(cancelled, false))
+		{
+			result = -1;
+			break;
+		}
+
+		if (timeout > 0 && elapsed >= timeout / 1000.0)
+		{
+			fprintf(stderr, "No device arrived\n\n");
+			result = -1;
+			break;
+		}
+
+		if (timeout > 0 && timeout / 1000.0 - elapsed < period)
+		{
+			period = timeout / 1000.0 - elapsed;
+		}
+
+		if (Registered)
+		{
+			struct timeval interval = { .tv_usec = period * 1e6 };
+
+			pthread_mutex_unlock(&Lock);
+			libusb_handle_events_timeout_completed(NULL, &interval,
+			                                       &waiter.arrived);
+			pthread_mutex_lock(&Lock);
+		}
+
+		else if (!scanDevices(&waiter))
+		{
+			waitForChange(period);
+		}
+	}
+
+	removeWaiter(&waiter);
+	pthread_mutex_unlock(&Lock);
+
+	if (waiter.arrival.time < start)
+	{
+		waiter.arrival.time = start;
+	}
+
+	*arrival = waiter.arrival;
+	return result;
+}
+
+void announceArrival(struct Arrival *arrival)
+{
+	bool dispatched = false;
+
+	pthread_mutex_lock(&Lock);
+
+	for (size_t index = 0; index < WaiterCount && !dispatched; index++)
+	{
+		if (matchArrival(Waiters[index], arrival))
+		{
+			struct Waiter *waiter = Waiters[index];
+
+			dispatchArrival(waiter, arrival);
+			removeWaiter(waiter);
+			dispatched = true;
+		}
+	}
+
+	if (!dispatched)
+	{
+		if (PendingCount == HOTPLUG_PENDING_COUNT)
+		{
+			discardArrival(&Pending[0]);
+			memmove(Pending, Pending + 1, --PendingCount * sizeof(*Pending));
+		}
+
+		Pending[PendingCount++] = *arrival;
+	}
+
+	pthread_cond_broadcast(&Changed);
+	pthread_mutex_unlock(&Lock);
+	libusb_interrupt_event_handler(NULL);
+}
+
+int scheduleArrival(struct Arrival *arrival, uint32_t delay)
+{
+	struct Timer *timer = NULL;
+	int result = 0;
+
+	pthread_mutex_lock(&Lock);
+
+	for (size_t index = 0; index < HOTPLUG_TIMER_COUNT; index++)
+	{
+		if (Timers[index].used && Timers[index].finished)
+		{
+			pthread_join(Timers[index].thread, NULL);
+			Timers[index].used = false;
+		}
+
+		if (!Timers[index].used)
+		{
+			timer = &Timers[index];
+			break;
+		}
+	}
+
+	if (timer == NULL)
+	{
+		pthread_mutex_unlock(&Lock);
+		fprintf(stderr, "Too many scheduled arrivals\n\n");
+		return -1;
+	}
+
+	timer->arrival = *arrival;
+	timer->deadline = measureTime() + delay / 1000.0;
+	timer->used = true;
+	timer->finished = false;
+
+	result = pthread_create(&timer->thread, NULL, runTimer, timer);
+
+	if (result != 0)
+	{
+		timer->used = false;
+		pthread_mutex_unlock(&Lock);
+		ERROR(strerror(result));
+		return -1;
+	}
+
+	pthread_mutex_unlock(&Lock);
+	return 0;
+}
+
+void discardArrival(struct Arrival *arrival)
+{
+	if (arrival->device)
+	{
+		libusb_unref_device(arrival->device);
+		arrival->device = NULL;
+	}
+
+	destroySimulator(arrival->simulator);
+	arrival->simulator = NULL;
+}
+
+void wakeArrivals(void)
+{
+	pthread_mutex_lock(&Lock);
+	pthread_cond_broadcast(&Changed);
+	pthread_mutex_unlock(&Lock);
+	libusb_interrupt_event_handler(NULL);
+}
+
+void holdDevice(libusb_device *device)
+{
+	pthread_mutex_lock(&Lock);
+	addHeld(device);
+	pthread_mutex_unlock(&Lock);
+}
+
+void dropDevice(libusb_device *device)
+{
+	pthread_mutex_lock(&Lock);
+
+	for (size_t index = 0; index < HeldCount; index++)
+	{
+		if (Held[index] == device)
+		{
+			Held[index] = Held[--HeldCount];
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&Lock);
+}
+
+static int LIBUSB_CALL receiveHotplug(libusb_context *context,
+                                      libusb_device *device,
+                                      libusb_hotplug_event event, void *data)
+{
+	struct libusb_device_descriptor descriptor;
+	struct Arrival arrival = { .device = device, .time = measureTime() };
+
+	if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT)
+	{
+		pthread_mutex_lock(&Lock);
+		withdrawDevice(device);
+		pthread_mutex_unlock(&Lock);
+		return 0;
+	}
+
+	if (libusb_get_device_descriptor(device, &descriptor) < 0)
+	{
+		return 0;
+	}
+
+	arrival.vendor = descriptor.idVendor;
+	arrival.product = descriptor.idProduct;
+	libusb_ref_device(device);
+	announceArrival(&arrival);
+	return 0;
+}
+
+static void *runTimer(void *argument)
+{
+	struct Timer *timer = argument;
+	struct Arrival arrival;
+	bool stopped = false;
+
+	pthread_mutex_lock(&Lock);
+
+	while (!Stopping && measureTime() < timer->deadline)
+	{
+		waitForChange(timer->deadline - measureTime());
+	}
+
+	stopped = Stopping;
+	arrival = timer->arrival;
+	pthread_mutex_unlock(&Lock);
+
+	if (stopped)
+	{
+		discardArrival(&arrival);
+	}
+
+	else
+	{
+		arrival.time = measureTime();
+		announceArrival(&arrival);
+	}
+
+	pthread_mutex_lock(&Lock);
+	timer->finished = true;
+	pthread_mutex_unlock(&Lock);
+	return NULL;
+}
+
+static void dispatchArrival(struct Waiter *waiter, struct Arrival *arrival)
+{
+	if (arrival->device)
+	{
+		addHeld(arrival->device);
+	}
+
+	waiter->arrival = *arrival;
+	waiter->arrived = 1;
+}
+
+static bool matchArrival(struct Waiter *waiter, struct Arrival *arrival)
+{
+	return waiter->vendor == arrival->vendor
+	    && waiter->product == arrival->product
+	    && (arrival->device == NULL || !isHeld(arrival->device));
+}
+
+static bool takePending(struct Waiter *waiter)
+{
+	for (size_t index = 0; index < PendingCount; index++)
+	{
+		if (matchArrival(waiter, &Pending[index]))
+		{
+			dispatchArrival(waiter, &Pending[index]);
+			memmove(Pending + index, Pending + index + 1,
+			        (--PendingCount - index) * sizeof(*Pending));
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool scanDevices(struct Waiter *waiter)
+{
+	libusb_device **devices = NULL;
+	ssize_t count = libusb_get_device_list(NULL, &devices);
+	bool found = false;
+
+	for (ssize_t index = 0; index < count && !found; index++)
+	{
+		struct libusb_device_descriptor descriptor;
+		struct Arrival arrival = { .device = devices[index] };
+
+		if (libusb_get_device_descriptor(devices[index], &descriptor) < 0)
+		{
+			continue;
+		}
+
+		arrival.vendor = descriptor.idVendor;
+		arrival.product = descriptor.idProduct;
+
+		if (matchArrival(waiter, &arrival))
+		{
+			arrival.device = libusb_ref_device(devices[index]);
+			arrival.time = measureTime();
+			dispatchArrival(waiter, &arrival);
+			found = true;
+		}
+	}
+
+	if (count >= 0)
+	{
+		libusb_free_device_list(devices, 1);
+	}
+
+	return found;
+}
+
+static void removeWaiter(struct Waiter *waiter)
+{
+	for (size_t index = 0; index < WaiterCount; index++)
+	{
+		if (Waiters[index] == waiter)
+		{
+			memmove(Waiters + index, Waiters + index + 1,
+			        (--WaiterCount - index) * sizeof(*Waiters));
+			break;
+		}
+	}
+}
+
+static void withdrawDevice(libusb_device *device)
+{
+	for (size_t index = 0; index < PendingCount; index++)
+	{
+		if (Pending[index].device == device)
+		{
+			discardArrival(&Pending[index]);
+			memmove(Pending + index, Pending + index + 1,
+			        (--PendingCount - index) * sizeof(*Pending));
+			break;
+		}
+	}
+}
+
+static void addHeld(libusb_device *device)
+{
+	if (!isHeld(device) && HeldCount < HOTPLUG_DEVICE_COUNT)
+	{
+		Held[HeldCount++] = device;
+	}
+}
+
+static bool isHeld(libusb_device *device)
+{
+	for (size_t index = 0; index < HeldCount; index++)
+	{
+		if (Held[index] == device)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void waitForChange(double seconds)
+{
+	struct timespec deadline;
+	long nanoseconds = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	nanoseconds = deadline.tv_nsec + (long)((seconds - (time_t)seconds) * 1e9);
+	deadline.tv_sec += (time_t)seconds + nanoseconds / 1000000000;
+	deadline.tv_nsec = nanoseconds % 1000000000;
+
+	pthread_cond_timedwait(&Changed, &Lock, &deadline);
+}
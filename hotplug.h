@@ -0,0 +1,38 @@
+#ifndef HOTPLUG_H
+#define HOTPLUG_H
+
+#include <libusb-1.0/libusb.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define HOTPLUG_WAITER_COUNT 16
+#define HOTPLUG_PENDING_COUNT 16
+#define HOTPLUG_DEVICE_COUNT 64
+#define HOTPLUG_TIMER_COUNT 16
+#define HOTPLUG_POLL_PERIOD 100
+
+struct Simulator;
+
+struct Arrival
+{
+	libusb_device *device;
+	struct Simulator *simulator;
+	uint16_t vendor;
+	uint16_t product;
+	double time;
+};
+
+void startHotplug(void);
+void stopHotplug(void);
+
+int awaitArrival(uint16_t vendor, uint16_t product, uint32_t timeout,
+                 atomic_bool *cancelled, struct Arrival *arrival);
+void announceArrival(struct Arrival *arrival);
+int scheduleArrival(struct Arrival *arrival, uint32_t delay);
+void discardArrival(struct Arrival *arrival);
+void wakeArrivals(void);
+
+void holdDevice(libusb_device *device);
+void dropDevice(libusb_device *device);
+
+#endif
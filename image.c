@@ -0,0 +1,868 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <lzma.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "frame.h"
+#include "image.h"
+
+struct Image
+{
+	enum ImageFormat format;
+	uint32_t size;
+	uint32_t produced;
+
+	int descriptor;
+	uint8_t *mapping;
+	size_t mappingSize;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t readable;
+	pthread_cond_t writable;
+
+	uint8_t *ring;
+	size_t head;
+	size_t tail;
+	bool running;
+	bool finished;
+	bool failed;
+	bool cancelled;
+
+	struct Segment *segments;
+	size_t segmentCount;
+	size_t segment;
+	uint32_t position;
+};
+
+static int mapImage(struct Image *, char *);
+static enum ImageFormat detectFormat(uint8_t *, size_t);
+static int determineSize(struct Image *);
+static int determineGzipSize(struct Image *);
+static int determineXzSize(struct Image *);
+static int determineZstdSize(struct Image *);
+
+static int startDecompression(struct Image *);
+static void stopDecompression(struct Image *);
+static void *decompress(void *);
+static int inflateImage(struct Image *);
+static int unxzImage(struct Image *);
+static int unzstdImage(struct Image *);
+
+static ssize_t readSegments(struct Image *, uint8_t *, size_t);
+static int skipImage(struct Image *, uint32_t);
+
+static size_t acquireSpace(struct Image *, uint8_t **);
+static void commitSpace(struct Image *, size_t);
+static void finishImage(struct Image *, bool);
+
+struct Image *openImage(char *filename)
+{
+	struct Image *image = calloc(1, sizeof(struct Image));
+
+	if (image == NULL)
+	{
+		ERROR(strerror(errno));
+		return NULL;
+	}
+
+	image->descriptor = -1;
+
+	if (mapImage(image, filename) == -1)
+	{
+		closeImage(image);
+		return NULL;
+	}
+
+	image->format = detectFormat(image->mapping, image->mappingSize);
+
+	if (determineSize(image) == -1)
+	{
+		closeImage(image);
+		return NULL;
+	}
+
+	if (image->format == RawImage)
+	{
+		return image;
+	}
+
+	image->ring = malloc(IMAGE_RING_SIZE);
+
+	if (image->ring == NULL)
+	{
+		ERROR(strerror(errno));
+		closeImage(image);
+		return NULL;
+	}
+
+	pthread_mutex_init(&image->lock, NULL);
+	pthread_cond_init(&image->readable, NULL);
+	pthread_cond_init(&image->writable, NULL);
+
+	if (startDecompression(image) == -1)
+	{
+		closeImage(image);
+		return NULL;
+	}
+
+	return image;
+}
+
+struct Image *joinImages(struct Segment *segments, size_t count)
+{
+	struct Image *image = calloc(1, sizeof(struct Image));
+	uint64_t size = 0;
+
+	if (image == NULL)
+	{
+		ERROR(strerror(errno));
+		return NULL;
+	}
+
+	image->descriptor = -1;
+	image->segments = malloc(count * sizeof(struct Segment));
+
+	if (image->segments == NULL)
+	{
+		ERROR(strerror(errno));
+		free(image);
+		return NULL;
+	}
+
+	for (size_t index = 0; index < count; index++)
+	{
+		struct Segment *segment = &segments[index];
+
+		if ((uint64_t)segment->offset + segment->length
+		    > getImageSize(segment->source))
+		{
+			ERROR("Segment exceeds its image");
+			closeImage(image);
+			return NULL;
+		}
+
+		if (segment->length > 0)
+		{
+			image->segments[image->segmentCount++] = *segment;
+			size += segment->length;
+		}
+	}
+
+	if (size > UINT32_MAX)
+	{
+		ERROR("Joined image too large");
+		closeImage(image);
+		return NULL;
+	}
+
+	image->size = size;
+	return image;
+}
+
+void closeImage(struct Image *image)
+{
+	if (image == NULL)
+	{
+		return;
+	}
+
+	if (image->ring)
+	{
+		stopDecompression(image);
+
+		pthread_mutex_destroy(&image->lock);
+		pthread_cond_destroy(&image->readable);
+		pthread_cond_destroy(&image->writable);
+		free(image->ring);
+	}
+
+	if (image->mapping)
+	{
+		munmap(image->mapping, image->mappingSize);
+	}
+
+	if (image->descriptor != -1)
+	{
+		close(image->descriptor);
+	}
+
+	free(image->segments);
+	free(image);
+}
+
+enum ImageFormat getImageFormat(struct Image *image)
+{
+	return image->format;
+}
+
+uint32_t getImageSize(struct Image *image)
+{
+	return image->size;
+}
+
+int rewindImage(struct Image *image)
+{
+	if (image->segments)
+	{
+		for (size_t index = 0; index < image->segmentCount; index++)
+		{
+			if (rewindImage(image->segments[index].source) == -1)
+			{
+				return -1;
+			}
+		}
+
+		image->segment = 0;
+		image->position = 0;
+		return 0;
+	}
+
+	if (image->ring == NULL)
+	{
+		image->tail = 0;
+		return 0;
+	}
+
+	stopDecompression(image);
+
+	image->produced = 0;
+	image->head = 0;
+	image->tail = 0;
+	image->finished = false;
+	image->failed = false;
+	image->cancelled = false;
+
+	return startDecompression(image);
+}
+
+ssize_t readImage(struct Image *image, uint8_t *buffer, size_t size)
+{
+	size_t count = 0;
+
+	if (image->segments)
+	{
+		return readSegments(image, buffer, size);
+	}
+
+	if (image->format == RawImage)
+	{
+		size_t remaining = image->size - image->tail;
+
+		count = size < remaining ? size : remaining;
+
+		if (count > 0)
+		{
+			memcpy(buffer, image->mapping + image->tail, count);
+			image->tail += count;
+		}
+
+		return count;
+	}
+
+	pthread_mutex_lock(&image->lock);
+
+	while (count < size)
+	{
+		size_t available = image->head - image->tail;
+		size_t offset = image->tail % IMAGE_RING_SIZE;
+		size_t length = size - count;
+
+		if (available == 0)
+		{
+			if (image->finished)
+			{
+				break;
+			}
+
+			pthread_cond_wait(&image->readable, &image->lock);
+			continue;
+		}
+
+		if (length > available)
+		{
+			length = available;
+		}
+
+		if (length > IMAGE_RING_SIZE - offset)
+		{
+			length = IMAGE_RING_SIZE - offset;
+		}
+
+		memcpy(buffer + count, image->ring + offset, length);
+		image->tail += length;
+		count += length;
+
+		pthread_cond_signal(&image->writable);
+	}
+
+	if (image->failed && count < size)
+	{
+		pthread_mutex_unlock(&image->lock);
+		return -1;
+	}
+
+	pthread_mutex_unlock(&image->lock);
+	return count;
+}
+
+static ssize_t readSegments(struct Image *image, uint8_t *buffer, size_t size)
+{
+	size_t count = 0;
+
+	while (count < size && image->segment < image->segmentCount)
+	{
+		struct Segment *segment = &image->segments[image->segment];
+		size_t length = segment->length - image->position;
+		ssize_t result = 0;
+
+		if (image->position == 0
+		 && skipImage(segment->source, segment->offset) == -1)
+		{
+			return -1;
+		}
+
+		if (length > size - count)
+		{
+			length = size - count;
+		}
+
+		result = readImage(segment->source, buffer + count, length);
+
+		if (result <= 0)
+		{
+			return -1;
+		}
+
+		count += result;
+		image->position += result;
+
+		if (image->position == segment->length)
+		{
+			image->segment++;
+			image->position = 0;
+		}
+	}
+
+	return count;
+}
+
+static int skipImage(struct Image *image, uint32_t length)
+{
+	uint8_t *scratch = NULL;
+
+	if (image->format == RawImage && image->segments == NULL)
+	{
+		if (length > image->size - image->tail)
+		{
+			return -1;
+		}
+
+		image->tail += length;
+		return 0;
+	}
+
+	scratch = malloc(IMAGE_SKIP_SIZE);
+
+	if (scratch == NULL)
+	{
+		ERROR(strerror(errno));
+		return -1;
+	}
+
+	while (length > 0)
+	{
+		ssize_t result = readImage(image, scratch, length < IMAGE_SKIP_SIZE
+		                                           ? length : IMAGE_SKIP_SIZE);
+
+		if (result <= 0)
+		{
+			free(scratch);
+			return -1;
+		}
+
+		length -= result;
+	}
+
+	free(scratch);
+	return 0;
+}
+
+static int mapImage(struct Image *image, char *filename)
+{
+	struct stat status;
+
+	image->descriptor = open(filename, O_RDONLY);
+
+	if (image->descriptor == -1)
+	{
+		fprintf(stderr, "%s\n\n", strerror(errno));
+		return -1;
+	}
+
+	if (fstat(image->descriptor, &status) == -1)
+	{
+		ERROR(strerror(errno));
+		return -1;
+	}
+
+	if (status.st_size == 0)
+	{
+		return 0;
+	}
+
+	image->mappingSize = status.st_size;
+	image->mapping = mmap(NULL, image->mappingSize, PROT_READ, MAP_PRIVATE,
+	                      image->descriptor, 0);
+
+	if (image->mapping == MAP_FAILED)
+	{
+		image->mapping = NULL;
+		ERROR(strerror(errno));
+		return -1;
+	}
+
+	madvise(image->mapping, image->mappingSize, MADV_SEQUENTIAL);
+	return 0;
+}
+
+static enum ImageFormat detectFormat(uint8_t *data, size_t size)
+{
+	static const uint8_t gzip[] = { 0x1f, 0x8b };
+	static const uint8_t xz[]   = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+	static const uint8_t zstd[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+	if (size >= sizeof(gzip) && memcmp(data, gzip, sizeof(gzip)) == 0)
+	{
+		return GzipImage;
+	}
+
+	if (size >= sizeof(xz) && memcmp(data, xz, sizeof(xz)) == 0)
+	{
+		return XzImage;
+	}
+
+	if (size >= sizeof(zstd) && memcmp(data, zstd, sizeof(zstd)) == 0)
+	{
+		return ZstdImage;
+	}
+
+	return RawImage;
+}
+
+static int determineSize(struct Image *image)
+{
+	switch (image->format)
+	{
+		case RawImage:
+			if (image->mappingSize > UINT32_MAX)
+			{
+				ERROR("Image too large");
+				return -1;
+			}
+
+			image->size = image->mappingSize;
+			return 0;
+
+		case GzipImage:
+			return determineGzipSize(image);
+
+		case XzImage:
+			return determineXzSize(image);
+
+		case ZstdImage:
+			return determineZstdSize(image);
+	}
+
+	return -1;
+}
+
+static int determineGzipSize(struct Image *image)
+{
+	uint8_t *trailer = NULL;
+
+	if (image->mappingSize < 18)
+	{
+		ERROR("Truncated gzip image");
+		return -1;
+	}
+
+	trailer = image->mapping + image->mappingSize - 4;
+	image->size = trailer[0]       | trailer[1] << 8
+	            | trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+	return 0;
+}
+
+static int determineXzSize(struct Image *image)
+{
+	lzma_stream_flags flags;
+	lzma_index *index = NULL;
+	uint64_t limit = UINT64_MAX;
+	size_t position = 0;
+	size_t end = image->mappingSize;
+	uint8_t *footer = NULL;
+	lzma_vli size = 0;
+
+	while (end >= LZMA_STREAM_HEADER_SIZE
+	    && memcmp(image->mapping + end - 4, "\0\0\0\0", 4) == 0)
+	{
+		end -= 4;
+	}
+
+	if (end < 2 * LZMA_STREAM_HEADER_SIZE)
+	{
+		ERROR("Truncated xz image");
+		return -1;
+	}
+
+	footer = image->mapping + end - LZMA_STREAM_HEADER_SIZE;
+
+	if (lzma_stream_footer_decode(&flags, footer) != LZMA_OK)
+	{
+		ERROR("Invalid xz stream footer");
+		return -1;
+	}
+
+	if (flags.backward_size > end - 2 * LZMA_STREAM_HEADER_SIZE)
+	{
+		ERROR("Invalid xz index size");
+		return -1;
+	}
+
+	if (lzma_index_buffer_decode(&index, &limit, NULL,
+	                             footer - flags.backward_size, &position,
+	                             flags.backward_size) != LZMA_OK)
+	{
+		ERROR("Invalid xz index");
+		return -1;
+	}
+
+	size = lzma_index_uncompressed_size(index);
+	lzma_index_end(index, NULL);
+
+	if (size > UINT32_MAX)
+	{
+		ERROR("Image too large");
+		return -1;
+	}
+
+	image->size = size;
+	return 0;
+}
+
+static int determineZstdSize(struct Image *image)
+{
+	uint8_t *cursor = image->mapping;
+	size_t remaining = image->mappingSize;
+	unsigned long long size = 0;
+
+	while (remaining > 0)
+	{
+		unsigned long long content = ZSTD_getFrameContentSize(cursor,
+		                                                      remaining);
+		size_t length = ZSTD_findFrameCompressedSize(cursor, remaining);
+
+		if (content == ZSTD_CONTENTSIZE_UNKNOWN)
+		{
+			ERROR("zstd frame does not record its content size");
+			return -1;
+		}
+
+		if (content == ZSTD_CONTENTSIZE_ERROR || ZSTD_isError(length))
+		{
+			ERROR("Invalid zstd frame");
+			return -1;
+		}
+
+		size += content;
+		cursor += length;
+		remaining -= length;
+	}
+
+	if (size > UINT32_MAX)
+	{
+		ERROR("Image too large");
+		return -1;
+	}
+
+	image->size = size;
+	return 0;
+}
+
+static int startDecompression(struct Image *image)
+{
+	int result = pthread_create(&image->thread, NULL, decompress, image);
+
+	if (result != 0)
+	{
+		ERROR(strerror(result));
+		image->failed = true;
+		image->finished = true;
+		return -1;
+	}
+
+	image->running = true;
+	return 0;
+}
+
+static void stopDecompression(struct Image *image)
+{
+	if (!image->running)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&image->lock);
+	image->cancelled = true;
+	pthread_cond_signal(&image->writable);
+	pthread_mutex_unlock(&image->lock);
+
+	pthread_join(image->thread, NULL);
+	image->running = false;
+}
+
+static void *decompress(void *argument)
+{
+	struct Image *image = argument;
+	int result = -1;
+
+	switch (image->format)
+	{
+		case GzipImage:
+			result = inflateImage(image);
+			break;
+
+		case XzImage:
+			result = unxzImage(image);
+			break;
+
+		case ZstdImage:
+			result = unzstdImage(image);
+			break;
+
+		case RawImage:
+			break;
+	}
+
+	if (result == 0 && image->produced != image->size)
+	{
+		ERROR("Decompressed size differs from recorded size");
+		result = -1;
+	}
+
+	finishImage(image, result == -1);
+	return NULL;
+}
+
+static int inflateImage(struct Image *image)
+{
+	z_stream stream = { 0 };
+	int result = Z_OK;
+
+	if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+	{
+		ERROR("inflateInit2 failed");
+		return -1;
+	}
+
+	stream.next_in = image->mapping;
+	stream.avail_in = image->mappingSize;
+
+	do
+	{
+		uint8_t *space = NULL;
+		size_t length = acquireSpace(image, &space);
+
+		if (length == 0)
+		{
+			inflateEnd(&stream);
+			return -1;
+		}
+
+		if (result == Z_STREAM_END)
+		{
+			inflateReset(&stream);
+		}
+
+		stream.next_out = space;
+		stream.avail_out = length;
+
+		result = inflate(&stream, Z_NO_FLUSH);
+
+		if (result == Z_BUF_ERROR)
+		{
+			ERROR("Truncated gzip image");
+			inflateEnd(&stream);
+			return -1;
+		}
+
+		if (result != Z_OK && result != Z_STREAM_END)
+		{
+			ERROR(stream.msg ? stream.msg : "inflate failed");
+			inflateEnd(&stream);
+			return -1;
+		}
+
+		commitSpace(image, length - stream.avail_out);
+	}
+	while (result != Z_STREAM_END || stream.avail_in > 0);
+
+	inflateEnd(&stream);
+	return 0;
+}
+
+static int unxzImage(struct Image *image)
+{
+	lzma_stream stream = LZMA_STREAM_INIT;
+	lzma_ret result = LZMA_OK;
+
+	if (lzma_stream_decoder(&stream, UINT64_MAX, LZMA_CONCATENATED)
+	    != LZMA_OK)
+	{
+		ERROR("lzma_stream_decoder failed");
+		return -1;
+	}
+
+	stream.next_in = image->mapping;
+	stream.avail_in = image->mappingSize;
+
+	while (result == LZMA_OK)
+	{
+		uint8_t *space = NULL;
+		size_t length = acquireSpace(image, &space);
+
+		if (length == 0)
+		{
+			lzma_end(&stream);
+			return -1;
+		}
+
+		stream.next_out = space;
+		stream.avail_out = length;
+
+		result = lzma_code(&stream, stream.avail_in ? LZMA_RUN
+		                                            : LZMA_FINISH);
+		commitSpace(image, length - stream.avail_out);
+	}
+
+	lzma_end(&stream);
+
+	if (result != LZMA_STREAM_END)
+	{
+		ERROR("xz decoding failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int unzstdImage(struct Image *image)
+{
+	ZSTD_DStream *stream = ZSTD_createDStream();
+	ZSTD_inBuffer input = { image->mapping, image->mappingSize, 0 };
+	size_t result = 1;
+
+	if (stream == NULL || ZSTD_isError(ZSTD_initDStream(stream)))
+	{
+		ERROR("ZSTD_initDStream failed");
+		ZSTD_freeDStream(stream);
+		return -1;
+	}
+
+	while (input.pos < input.size || result != 0)
+	{
+		uint8_t *space = NULL;
+		size_t length = acquireSpace(image, &space);
+		size_t consumed = input.pos;
+		ZSTD_outBuffer output = { space, length, 0 };
+
+		if (length == 0)
+		{
+			ZSTD_freeDStream(stream);
+			return -1;
+		}
+
+		result = ZSTD_decompressStream(stream, &output, &input);
+
+		if (ZSTD_isError(result))
+		{
+			ERROR(ZSTD_getErrorName(result));
+			ZSTD_freeDStream(stream);
+			return -1;
+		}
+
+		if (output.pos == 0 && input.pos == consumed)
+		{
+			ERROR("Truncated zstd image");
+			ZSTD_freeDStream(stream);
+			return -1;
+		}
+
+		commitSpace(image, output.pos);
+	}
+
+	ZSTD_freeDStream(stream);
+	return 0;
+}
+
+static size_t acquireSpace(struct Image *image, uint8_t **space)
+{
+	size_t length = 0;
+
+	pthread_mutex_lock(&image->lock);
+
+	while (!image->cancelled && image->head - image->tail == IMAGE_RING_SIZE)
+	{
+		pthread_cond_wait(&image->writable, &image->lock);
+	}
+
+	if (!image->cancelled)
+	{
+		size_t offset = image->head % IMAGE_RING_SIZE;
+		size_t vacant = IMAGE_RING_SIZE - (image->head - image->tail);
+
+		length = IMAGE_RING_SIZE - offset;
+
+		if (length > vacant)
+		{
+			length = vacant;
+		}
+
+		*space = image->ring + offset;
+	}
+
+	pthread_mutex_unlock(&image->lock);
+	return length;
+}
+
+static void commitSpace(struct Image *image, size_t length)
+{
+	if (length == 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&image->lock);
+	image->head += length;
+	image->produced += length;
+	pthread_cond_signal(&image->readable);
+	pthread_mutex_unlock(&image->lock);
+}
+
+static void finishImage(struct Image *image, bool failed)
+{
+	pthread_mutex_lock(&image->lock);
+	image->finished = true;
+	image->failed = failed;
+	pthread_cond_signal(&image->readable);
+	pthread_mutex_unlock(&image->lock);
+}
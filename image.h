@@ -0,0 +1,38 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define IMAGE_RING_SIZE (1 << 20)
+
+enum ImageFormat
+{
+	RawImage,
+	GzipImage,
+	XzImage,
+	ZstdImage
+};
+
+#define IMAGE_SKIP_SIZE 65536
+
+struct Image;
+
+struct Segment
+{
+	struct Image *source;
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct Image *openImage(char *filename);
+struct Image *joinImages(struct Segment *segments, size_t count);
+void closeImage(struct Image *image);
+
+enum ImageFormat getImageFormat(struct Image *image);
+uint32_t getImageSize(struct Image *image);
+int rewindImage(struct Image *image);
+ssize_t readImage(struct Image *image, uint8_t *buffer, size_t size);
+
+#endif
@@ -0,0 +1,370 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "job.h"
+#include "system.h"
+
+enum JobState
+{
+	JobIdle,
+	JobRunning,
+	JobFinished
+};
+
+struct Job
+{
+	unsigned id;
+	char command[JOB_COMMAND_SIZE];
+	struct Session *sessions[JOB_SESSION_COUNT];
+	size_t sessionCount;
+	int (*run)(struct Session *, char *);
+	pthread_t thread;
+
+	atomic_int state;
+	atomic_bool cancelled;
+	int result;
+	atomic_uint_least32_t done;
+	atomic_uint_least32_t total;
+	double start;
+	double finish;
+};
+
+static struct Job Jobs[JOB_COUNT];
+static struct Job Foreground;
+static unsigned NextJob = 1;
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local struct Job *Current = NULL;
+
+static void *runJob(void *);
+static void showJob(struct Job *);
+static void updateJob(void *, uint32_t, uint32_t);
+static struct Job *findJob(unsigned);
+static void reapJob(struct Job *);
+static bool isBusy(struct Session *);
+static bool isListed(struct Job *, struct Session *);
+
+int startJob(struct Session *session, char *command,
+             int (*run)(struct Session *, char *))
+{
+	struct Job *job = NULL;
+	int result = 0;
+
+	for (size_t index = 0; index < JOB_COUNT && job == NULL; index++)
+	{
+		if (atomic_load(&Jobs[index].state) == JobIdle)
+		{
+			job = &Jobs[index];
+		}
+	}
+
+	for (size_t index = 0; index < JOB_COUNT && job == NULL; index++)
+	{
+		if (atomic_load(&Jobs[index].state) == JobFinished)
+		{
+			reapJob(&Jobs[index]);
+			job = &Jobs[index];
+		}
+	}
+
+	if (job == NULL)
+	{
+		fprintf(stderr, "Too many jobs\n\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&Lock);
+
+	if (isListed(&Foreground, session) || isBusy(session))
+	{
+		pthread_mutex_unlock(&Lock);
+		fprintf(stderr, "Session busy\n\n");
+		return -1;
+	}
+
+	job->id = NextJob++;
+	snprintf(job->command, sizeof(job->command), "%s", command);
+	job->sessions[0] = session;
+	job->sessionCount = 1;
+	job->run = run;
+	job->start = measureTime();
+	job->finish = 0;
+	job->result = 0;
+
+	atomic_store(&job->cancelled, false);
+	atomic_store(&job->done, 0);
+	atomic_store(&job->total, 0);
+	atomic_store(&job->state, JobRunning);
+	pthread_mutex_unlock(&Lock);
+
+	session->progress = updateJob;
+	session->progressContext = job;
+
+	result = pthread_create(&job->thread, NULL, runJob, job);
+
+	if (result != 0)
+	{
+		ERROR(strerror(result));
+		session->progress = NULL;
+		session->progressContext = NULL;
+		atomic_store(&job->state, JobIdle);
+		return -1;
+	}
+
+	printf("  [%u] %.*s\n\n", job->id,
+	       (int)strcspn(job->command, "\n"), job->command);
+	return 0;
+}
+
+void listJobs(void)
+{
+	for (size_t index = 0; index < JOB_COUNT; index++)
+	{
+		if (atomic_load(&Jobs[index].state) != JobIdle)
+		{
+			showJob(&Jobs[index]);
+		}
+	}
+
+	printf("\n");
+}
+
+int waitJob(unsigned id)
+{
+	struct Job *job = NULL;
+	int result = 0;
+
+	if (id == 0)
+	{
+		for (size_t index = 0; index < JOB_COUNT; index++)
+		{
+			if (atomic_load(&Jobs[index].state) != JobIdle)
+			{
+				reapJob(&Jobs[index]);
+				showJob(&Jobs[index]);
+
+				if (Jobs[index].result == -1)
+				{
+					result = -1;
+				}
+			}
+		}
+
+		printf("\n");
+		return result;
+	}
+
+	job = findJob(id);
+
+	if (job == NULL)
+	{
+		fprintf(stderr, "No such job\n\n");
+		return -1;
+	}
+
+	reapJob(job);
+	showJob(job);
+	printf("\n");
+	return job->result;
+}
+
+int cancelJob(unsigned id)
+{
+	struct Job *job = findJob(id);
+
+	if (job == NULL)
+	{
+		fprintf(stderr, "No such job\n\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&Lock);
+
+	if (atomic_load(&job->state) == JobRunning)
+	{
+		atomic_store(&job->cancelled, true);
+
+		for (size_t index = 0; index < job->sessionCount; index++)
+		{
+			usxCancel(job->sessions[index]);
+		}
+	}
+
+	pthread_mutex_unlock(&Lock);
+	return 0;
+}
+
+void cancelJobs(void)
+{
+	for (size_t index = 0; index < JOB_COUNT; index++)
+	{
+		if (atomic_load(&Jobs[index].state) == JobRunning)
+		{
+			cancelJob(Jobs[index].id);
+		}
+
+		reapJob(&Jobs[index]);
+	}
+}
+
+bool isSessionBusy(struct Session *session)
+{
+	bool busy = false;
+
+	pthread_mutex_lock(&Lock);
+	busy = isBusy(session);
+	pthread_mutex_unlock(&Lock);
+
+	return busy;
+}
+
+int claimSession(struct Session *session)
+{
+	struct Job *job = Current ? Current : &Foreground;
+
+	pthread_mutex_lock(&Lock);
+
+	if (isListed(&Foreground, session) || isBusy(session)
+	 || job->sessionCount == JOB_SESSION_COUNT)
+	{
+		pthread_mutex_unlock(&Lock);
+		return -1;
+	}
+
+	job->sessions[job->sessionCount++] = session;
+	pthread_mutex_unlock(&Lock);
+	return 0;
+}
+
+void releaseSession(struct Session *session)
+{
+	struct Job *job = Current ? Current : &Foreground;
+
+	pthread_mutex_lock(&Lock);
+
+	for (size_t index = 0; index < job->sessionCount; index++)
+	{
+		if (job->sessions[index] == session)
+		{
+			job->sessions[index] = job->sessions[--job->sessionCount];
+			atomic_store(&session->cancelled, false);
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&Lock);
+}
+
+static void *runJob(void *argument)
+{
+	struct Job *job = argument;
+	struct Session *session = job->sessions[0];
+	char command[JOB_COMMAND_SIZE];
+
+	Current = job;
+	memcpy(command, job->command, sizeof(command));
+	job->result = job->run(session, command);
+
+	session->progress = NULL;
+	session->progressContext = NULL;
+	job->finish = measureTime();
+
+	pthread_mutex_lock(&Lock);
+
+	for (size_t index = 0; index < job->sessionCount; index++)
+	{
+		atomic_store(&job->sessions[index]->cancelled, false);
+	}
+
+	job->sessionCount = 0;
+	atomic_store(&job->state, JobFinished);
+	pthread_mutex_unlock(&Lock);
+	return NULL;
+}
+
+static void showJob(struct Job *job)
+{
+	uint32_t done = atomic_load(&job->done);
+	uint32_t total = atomic_load(&job->total);
+	double elapsed = measureTime() - job->start;
+	char *label = "running";
+
+	if (atomic_load(&job->state) != JobRunning)
+	{
+		label = atomic_load(&job->cancelled) ? "cancelled"
+		      : job->result == -1 ? "failed" : "done";
+		elapsed = job->finish - job->start;
+	}
+
+	printf("  [%u] %-9s", job->id, label);
+
+	if (total > 0)
+	{
+		printf(" %3u%%  %8.1f KiB/s",
+		       (unsigned)((uint64_t)done * 100 / total),
+		       elapsed > 0 ? done / elapsed / 1024 : 0);
+	}
+
+	printf("  %.*s\n", (int)strcspn(job->command, "\n"), job->command);
+}
+
+static void updateJob(void *context, uint32_t done, uint32_t total)
+{
+	struct Job *job = context;
+
+	atomic_store_explicit(&job->done, done, memory_order_relaxed);
+	atomic_store_explicit(&job->total, total, memory_order_relaxed);
+}
+
+static struct Job *findJob(unsigned id)
+{
+	for (size_t index = 0; index < JOB_COUNT; index++)
+	{
+		if (Jobs[index].id == id && atomic_load(&Jobs[index].state) != JobIdle)
+		{
+			return &Jobs[index];
+		}
+	}
+
+	return NULL;
+}
+
+static void reapJob(struct Job *job)
+{
+	if (atomic_load(&job->state) == JobIdle)
+	{
+		return;
+	}
+
+	pthread_join(job->thread, NULL);
+	atomic_store(&job->state, JobIdle);
+}
+
+static bool isBusy(struct Session *session)
+{
+	for (size_t index = 0; index < JOB_COUNT; index++)
+	{
+		if (atomic_load(&Jobs[index].state) == JobRunning
+		 && isListed(&Jobs[index], session))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool isListed(struct Job *job, struct Session *session)
+{
+	for (size_t index = 0; index < job->sessionCount; index++)
+	{
+		if (job->sessions[index] == session)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,22 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <stdbool.h>
+
+#include "usx.h"
+
+#define JOB_COUNT 16
+#define JOB_COMMAND_SIZE 256
+#define JOB_SESSION_COUNT 8
+
+int startJob(struct Session *session, char *command,
+             int (*run)(struct Session *, char *));
+void listJobs(void);
+int waitJob(unsigned id);
+int cancelJob(unsigned id);
+void cancelJobs(void);
+bool isSessionBusy(struct Session *session);
+int claimSession(struct Session *session);
+void releaseSession(struct Session *session);
+
+#endif
@@ -0,0 +1,212 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "layout.h"
+#include "parse.h"
+
+static int parseRegion(struct Region *, char *, char *);
+static int parseField(char **, uint32_t *);
+
+struct Region *loadLayout(char *filename, size_t *count)
+{
+	char buffer[LAYOUT_LINE_SIZE];
+	struct Region *regions = NULL;
+	size_t capacity = 0;
+	unsigned line = 0;
+	bool failed = false;
+	FILE *stream = fopen(filename, "r");
+
+	*count = 0;
+
+	if (stream == NULL)
+	{
+		fprintf(stderr, "%s: %s\n\n", filename, strerror(errno));
+		return NULL;
+	}
+
+	while (fgets(buffer, sizeof(buffer), stream) != NULL)
+	{
+		char *cursor = buffer;
+		size_t length = strlen(buffer);
+
+		line++;
+
+		if (length == sizeof(buffer) - 1 && buffer[length - 1] != '\n')
+		{
+			fprintf(stderr, "%s:%u: Line too long\n\n", filename, line);
+			failed = true;
+			break;
+		}
+
+		if (length == 0 || buffer[length - 1] != '\n')
+		{
+			strcpy(buffer + length, "\n");
+		}
+
+		skipSpace(&cursor);
+
+		if (*cursor == 0 || *cursor == '#')
+		{
+			continue;
+		}
+
+		if (*count == capacity)
+		{
+			size_t size = capacity ? capacity * 2 : 16;
+			struct Region *resized = realloc(regions,
+			                                 size * sizeof(struct Region));
+
+			if (resized == NULL)
+			{
+				ERROR(strerror(errno));
+				failed = true;
+				break;
+			}
+
+			regions = resized;
+			capacity = size;
+		}
+
+		if (parseRegion(&regions[*count], cursor, filename) == -1)
+		{
+			fprintf(stderr, "%s:%u: Invalid region\n\n", filename, line);
+			failed = true;
+			break;
+		}
+
+		(*count)++;
+	}
+
+	if (ferror(stream))
+	{
+		fprintf(stderr, "%s: %s\n\n", filename, strerror(errno));
+		failed = true;
+	}
+
+	if (failed)
+	{
+		fclose(stream);
+		destroyLayout(regions, *count);
+		*count = 0;
+		return NULL;
+	}
+
+	fclose(stream);
+
+	if (*count == 0)
+	{
+		fprintf(stderr, "%s: No regions\n\n", filename);
+		free(regions);
+		return NULL;
+	}
+
+	return regions;
+}
+
+void reportLayout(FILE *output, struct Region *regions, size_t count,
+                  unsigned transfers)
+{
+	uint64_t bytes = 0;
+	double seconds = 0;
+
+	for (size_t index = 0; index < count; index++)
+	{
+		struct Region *region = &regions[index];
+
+		fprintf(output, "  Region     %08x  %8x bytes  transfer %-3u %-6s  "
+		        "%s+%x\n", region->address, region->length,
+		        region->transfer + 1, region->sent ? "sent" : "unsent",
+		        region->filename, region->offset);
+
+		if (region->sent)
+		{
+			bytes += region->length;
+		}
+
+		if (region->sent
+		 && (index == 0 || region->transfer != regions[index - 1].transfer))
+		{
+			seconds += region->elapsed;
+		}
+	}
+
+	fprintf(output, "\n  Regions    %zu in %u transfers  %llu bytes  "
+	        "%.3f s\n\n", count, transfers, (unsigned long long)bytes,
+	        seconds);
+}
+
+void destroyLayout(struct Region *regions, size_t count)
+{
+	for (size_t index = 0; regions && index < count; index++)
+	{
+		free(regions[index].filename);
+	}
+
+	free(regions);
+}
+
+static int parseRegion(struct Region *region, char *cursor, char *layout)
+{
+	char path[PATH_MAX];
+	char *token = NULL;
+	char *slash = strrchr(layout, '/');
+
+	memset(region, 0, sizeof(*region));
+
+	if (parseFilename(&cursor, &token) == -1 || *token == 0)
+	{
+		return -1;
+	}
+
+	if (parseField(&cursor, &region->offset) == -1
+	 || parseField(&cursor, &region->length) == -1
+	 || parseField(&cursor, &region->address) == -1)
+	{
+		return -1;
+	}
+
+	skipSpace(&cursor);
+
+	if (*cursor)
+	{
+		return -1;
+	}
+
+	if (*token != '/' && slash)
+	{
+		int length = snprintf(path, sizeof(path), "%.*s/%s",
+		                      (int)(slash - layout), layout, token);
+
+		if (length < 0 || length >= sizeof(path))
+		{
+			return -1;
+		}
+
+		token = path;
+	}
+
+	region->filename = strdup(token);
+
+	if (region->filename == NULL)
+	{
+		ERROR(strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int parseField(char **cursor, uint32_t *value)
+{
+	skipSpace(cursor);
+
+	if (**cursor == 0)
+	{
+		return -1;
+	}
+
+	return parseUInt32(cursor, value);
+}
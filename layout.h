@@ -0,0 +1,16 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "usx.h"
+
+#define LAYOUT_LINE_SIZE 512
+
+struct Region *loadLayout(char *filename, size_t *count);
+void reportLayout(FILE *output, struct Region *regions, size_t count,
+                  unsigned transfers);
+void destroyLayout(struct Region *regions, size_t count);
+
+#endif
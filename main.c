@@ -1,35 +1,46 @@
-#include <libusb-1.0/libusb.h>
-#include <netinet/in.h>
 #include <ctype.h>
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 
+#include "boot.h"
 #include "command.h"
+#include "image.h"
+#include "job.h"
+#include "layout.h"
 #include "parse.h"
-#include "frame.h"
+#include "plan.h"
+#include "scheduler.h"
+#include "serial.h"
+#include "trace.h"
+#include "usx.h"
 
-libusb_device_handle *Handle = NULL;
+#define SESSION_COUNT 8
 
-uint32_t Timeout = 3000;
-uint16_t BlockSize = 512;
-uint16_t Vendor = 0;
-uint16_t Product = 0;
-uint16_t Interface = 0;
-uint16_t Input = 0;
-uint16_t Output = 0;
-uint32_t Partition = 0;
-uint32_t BaseAddress = 0;
+struct Session *Sessions[SESSION_COUNT];
+_Thread_local struct Session *Session = NULL;
+_Thread_local int Status = 0;
+unsigned Current = 0;
+struct Scheduler *Scheduler = NULL;
 
 bool Interactive = true;
-bool Verbose = true;
+bool Validating = false;
 
 static int initialise(void);
 static void interact(void);
+static int batch(struct Plan *);
 static void cleanup(void);
+static int runCommand(struct Session *, char *);
+static int executeCommand(char *);
+static int checkCommand(char *);
+static bool isBackground(char *);
+static bool isIdleCommand(char *);
+static int parseSimulation(char *, uint16_t *, struct Topology *);
+static void reportSend(void);
+static int checkImage(char *);
+static void showLayout(char *, struct Region *, size_t);
 
 static void serveCommandsRequest();
 static void serveSilentRequest();
@@ -40,22 +51,35 @@ static void serveDeviceShowRequest();
 static void serveOpenRequest();
 static void serveCloseRequest();
 static void serveGreetRequest();
+static void serveAwaitRequest(char *);
+static void serveArriveRequest(char *);
 static void serveConnectRequest();
 static void serveResetRequest();
 static void serveFramingRequest(char *);
 static void serveSendRequest(char *);
+static void serveScatterRequest(char *);
+static void serveBroadcastRequest(char *);
+static void serveDumpRequest(char *);
+static void serveEraseRequest(char *);
 static void serveExecuteRequest();
-
-static int sendFile(char *, uint32_t);
-static long determineFileSize(FILE *);
-static int startDataTransfer(uint32_t, uint32_t);
-static int transferData(uint8_t *, size_t);
-static int endDataTransfer(void);
-
-static int exchange(struct Frame *, struct Frame **);
-static int transmit(uint8_t *, size_t);
-static int receive(uint8_t *, size_t, int *);
-static void dump(uint8_t *, size_t, FILE *);
+static void serveBootRequest();
+static void serveBlockSizeRequest(char *);
+static void serveTuneRequest(char *);
+static void serveSimulateRequest(char *);
+static void serveSerialRequest(char *);
+static void serveSessionRequest(char *);
+static void serveJobsRequest();
+static void serveWaitRequest(char *);
+static void serveCancelRequest(char *);
+static void serveScheduleRequest(char *);
+static void serveScheduleShowRequest();
+static void serveLinkRequest(char *);
+static void servePackingRequest(char *);
+static void servePreEraseRequest(char *);
+static void serveVerifyRequest(char *);
+static void serveRealTimeRequest(char *);
+static void serveGapsShowRequest();
+static void serveReportRequest();
 
 static struct Command Commands[] = 
 {
@@ -68,22 +92,79 @@ static struct Command Commands[] =
 	{ "open\n",     serveOpenRequest },
 	{ "close\n",    serveCloseRequest },
 	{ "greet\n",    serveGreetRequest },
+	{ "await\n",    serveAwaitRequest },
+	{ "await ",     serveAwaitRequest },
+	{ "arrive ",    serveArriveRequest },
 	{ "connect\n",  serveConnectRequest },
 	{ "reset\n",    serveResetRequest },
 	{ "framing ",   serveFramingRequest },
 	{ "send ",      serveSendRequest },
+	{ "scatter ",   serveScatterRequest },
+	{ "broadcast ", serveBroadcastRequest },
+	{ "dump ",      serveDumpRequest },
+	{ "erase ",     serveEraseRequest },
 	{ "execute\n",  serveExecuteRequest },
+	{ "boot\n",     serveBootRequest },
+	{ "blocksize ", serveBlockSizeRequest },
+	{ "tune ",      serveTuneRequest },
+	{ "simulate ",  serveSimulateRequest },
+	{ "serial ",    serveSerialRequest },
+	{ "session ",   serveSessionRequest },
+	{ "jobs\n",     serveJobsRequest },
+	{ "wait\n",     serveWaitRequest },
+	{ "wait ",      serveWaitRequest },
+	{ "cancel ",    serveCancelRequest },
+	{ "schedule ",  serveScheduleRequest },
+	{ "schedule?\n", serveScheduleShowRequest },
+	{ "link ",      serveLinkRequest },
+	{ "packing ",   servePackingRequest },
+	{ "preerase ",  servePreEraseRequest },
+	{ "verify ",    serveVerifyRequest },
+	{ "realtime ",  serveRealTimeRequest },
+	{ "gaps?\n",    serveGapsShowRequest },
+	{ "report\n",   serveReportRequest },
 };
 
 static const size_t CommandCount = sizeof(Commands) / sizeof(*Commands);
 
+static char *IdleCommands[] =
+{
+	"?\n", "silent\n", "verbose\n", "quit\n", "device?\n",
+	"session ", "jobs\n", "wait\n", "wait ", "cancel ", "schedule?\n",
+	"gaps?\n", "report\n", "arrive "
+};
+
+static const size_t IdleCommandCount = sizeof(IdleCommands)
+                                     / sizeof(*IdleCommands);
+
 int main(int argc, char *argv[])
 {
+	struct Plan *plan = NULL;
+
+	if (argc > 2)
+	{
+		fprintf(stderr, "Usage: %s [PLAN]\n\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
 	if (initialise() == -1)
 	{
 		return EXIT_FAILURE;
 	}
 
+	if (argc == 2)
+	{
+		plan = loadPlan(argv[1], checkCommand);
+
+		if (plan == NULL)
+		{
+			cleanup();
+			return EXIT_FAILURE;
+		}
+
+		return batch(plan) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	interact();
 
 	return EXIT_SUCCESS;
@@ -91,36 +172,166 @@ int main(int argc, char *argv[])
 
 static int initialise(void)
 {
-	int result = libusb_init(NULL);
+	if (usxInitialise() == -1)
+	{
+		return -1;
+	}
+
+	Session = usxCreateSession();
 
-	if (result < 0)
+	if (Session == NULL)
 	{
-		fprintf(stderr, "%s\n\n", libusb_strerror(result));
+		usxCleanup();
 		return -1;
 	}
 
+	Sessions[Current] = Session;
 	return 0;
 }
 
 static void interact(void)
 {
 	char buffer[BUFSIZ];
+	char label[16];
 
 	while (Interactive)
 	{
-		prompt("usx");
+		flushTrace();
+		snprintf(label, sizeof(label), Current ? "usx:%u" : "usx", Current);
+		prompt(label);
 
 		if (readCommand(buffer, sizeof(buffer)) == -1)
 		{
 			break;
 		}
 
-		parseCommand(Commands, CommandCount, buffer);
+		executeCommand(buffer);
 	}
 
 	cleanup();
 }
 
+static int batch(struct Plan *plan)
+{
+	int result = runPlan(plan, executeCommand);
+
+	destroyPlan(plan);
+	cleanup();
+	return result;
+}
+
+static int runCommand(struct Session *session, char *command)
+{
+	enum Framing framing = session->framing;
+
+	Session = session;
+	Status = 0;
+
+	if (parseCommand(Commands, CommandCount, command) == -1)
+	{
+		Status = -1;
+	}
+
+	if (session->framing != framing)
+	{
+		printf("  Framing    %s\n\n", labelFraming(session->framing));
+	}
+
+	return Status;
+}
+
+static int executeCommand(char *buffer)
+{
+	struct Session *session = Session;
+	int result = 0;
+
+	if (isBackground(buffer))
+	{
+		return startJob(session, buffer, runCommand);
+	}
+
+	if (isIdleCommand(buffer))
+	{
+		return runCommand(session, buffer);
+	}
+
+	if (claimSession(session) == -1)
+	{
+		fprintf(stderr, "Session busy\n\n");
+		return -1;
+	}
+
+	result = runCommand(session, buffer);
+	releaseSession(session);
+	return result;
+}
+
+static int checkCommand(char *buffer)
+{
+	struct Command *command = NULL;
+	char *cursor = buffer;
+
+	isBackground(buffer);
+	command = findCommand(Commands, CommandCount, &cursor);
+
+	if (command == NULL)
+	{
+		return -1;
+	}
+
+	if (command->trigger[strlen(command->trigger) - 1] == '\n')
+	{
+		return 0;
+	}
+
+	Status = 0;
+	Validating = true;
+	command->function(cursor);
+	Validating = false;
+
+	return Status;
+}
+
+static bool isBackground(char *buffer)
+{
+	char *end = buffer + strlen(buffer);
+
+	while (end > buffer && isspace((unsigned char)end[-1]))
+	{
+		end--;
+	}
+
+	if (end == buffer || end[-1] != '&')
+	{
+		return false;
+	}
+
+	end--;
+
+	while (end > buffer && isspace((unsigned char)end[-1]))
+	{
+		end--;
+	}
+
+	strcpy(end, "\n");
+	return true;
+}
+
+static bool isIdleCommand(char *buffer)
+{
+	for (size_t index = 0; index < IdleCommandCount; index++)
+	{
+		char *cursor = buffer;
+
+		if (matchToken(&cursor, IdleCommands[index]) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static void serveCommandsRequest(void)
 {
 	printf("  verbose                     Be verbose\n"
@@ -129,25 +340,60 @@ static void serveCommandsRequest(void)
 	       "\n"
 	       "  device VID PID IF IN OUT    Set device parameters\n"
 	       "  device?                     Show device parameters\n"
+	       "  simulate MAXIMUM [TOPOLOGY [SPEED]]\n"
+	       "                              Simulate device with maximum payload\n"
+	       "  serial PATH [BAUD]          Use UART or CDC-ACM tty instead of USB\n"
+	       "                              (loopback serves simulated device)\n"
 	       "  open                        Open device\n"
 	       "  close                       Close device\n"
 	       "  greet                       Greet device\n"                      
+	       "  await [TIMEOUT]             Open and greet device when it arrives\n"
+	       "  arrive DELAY MAXIMUM [TOPOLOGY [SPEED]]\n"
+	       "                              Simulate device arrival after delay\n"
 	       "  connect                     Connect to device\n"
 	       "  reset                       Reset device\n"
 	       "\n"
 	       "  framing MODE                Select bootrom or fdl mode\n"
-	       "  send FILE ADDRESS           Send file to address\n"
-	       "  execute ADDRESS             Execute code at address\n\n");
+	       "                              (detected from device responses)\n"
+	       "  send FILE ADDRESS           Send raw, gz, xz or zst file\n"
+	       "  scatter LAYOUT              Send regions listed as lines of\n"
+	       "                              FILE OFFSET LENGTH ADDRESS\n"
+	       "  broadcast FILE ADDRESS      Send file to every open session\n"
+	       "  dump FILE ADDRESS SIZE      Dump flash region to file\n"
+	       "  erase ADDRESS SIZE          Erase sectors covering flash region\n"
+	       "  execute ADDRESS             Execute code at address\n"
+	       "  boot                        Load and execute bundled FDLs\n"
+	       "\n"
+	       "  blocksize SIZE              Set data transfer block size\n"
+	       "  packing on|off              Fill whole USB packets per frame\n"
+	       "  preerase on|off             Erase whole sectors inside each send\n"
+	       "  verify on|off               Read back, compare and repair each send\n"
+	       "  realtime on [CORE]|off      Prioritise the transfer loop\n"
+	       "                              (pinned to CORE when given)\n"
+	       "  gaps?                       Show inter-frame gap histogram\n"
+	       "  tune ADDRESS [LIMIT]        Tune block size using scratch address\n"
+	       "\n"
+	       "  COMMAND &                   Run command in the background\n"
+	       "  jobs                        List background jobs\n"
+	       "  wait [JOB]                  Wait for one or all jobs\n"
+	       "  cancel JOB                  Cancel job\n"
+	       "  session NUMBER              Select session for another device\n"
+	       "\n"
+	       "  schedule on|off             Share hub and root port bandwidth\n"
+	       "  schedule?                   Show scheduled links\n"
+	       "  link TOPOLOGY BANDWIDTH     Set link bandwidth in bytes/s\n"
+	       "\n"
+	       "  report                      Summarise recorded session history\n\n");
 }
 
 static void serveSilentRequest()
 {
-	Verbose = false;
+	Session->verbose = false;
 }
 
 static void serveVerboseRequest()
 {
-	Verbose = true;
+	Session->verbose = true;
 }
 
 static void serveQuitRequest()
@@ -166,534 +412,1023 @@ static void serveDeviceRequest(char *cursor)
 	if (parseUInt16(&cursor, &vendor) == -1)
 	{
 		fprintf(stderr, "Invalid USB vendor identifier\n\n");
+		Status = -1;
 	}
 
 	if (parseUInt16(&cursor, &product) == -1)
 	{
 		fprintf(stderr, "Invalid USB product identifier\n\n");
+		Status = -1;
 	}
 
 	if (parseUInt16(&cursor, &interface) == -1)
 	{
 		fprintf(stderr, "Invalid device interface\n\n");
+		Status = -1;
 	}
 
 	if (parseUInt16(&cursor, &input) == -1)
 	{
 		fprintf(stderr, "Invalid input endpoint\n\n");
+		Status = -1;
 	}
 
 	if (parseUInt16(&cursor, &output) == -1)
 	{
 		fprintf(stderr, "Invalid output endpoint\n\n");
+		Status = -1;
+	}
+
+	if (Validating)
+	{
+		return;
 	}
 
-	Vendor = vendor;
-	Product = product;
-	Interface = interface;
-	Input = input;
-	Output = output;
+	Session->vendor = vendor;
+	Session->product = product;
+	Session->interface = interface;
+	Session->input = input;
+	Session->output = output;
 }
 
 static void serveDeviceShowRequest()
 {
-	printf("  Vendor     %04x\n",   Vendor);
-	printf("  Product    %04x\n",   Product);
-	printf("  Interface  %02x\n",   Interface);
-	printf("  Input      %02x\n",   Input);
-	printf("  Output     %02x\n\n", Output);
+	printf("  Vendor     %04x\n",   Session->vendor);
+	printf("  Product    %04x\n",   Session->product);
+	printf("  Interface  %02x\n",   Session->interface);
+	printf("  Input      %02x\n",   Session->input);
+	printf("  Output     %02x\n",   Session->output);
+	printf("  Block Size %04x\n",   Session->blockSize);
+	printf("  Zero Copy  %s\n",     Session->zeroCopy ? "yes" : "no");
+	printf("  Timeout    %u\n",     Session->timeout);
+	printf("  Framing    %s\n",     labelFraming(Session->framing));
+	printf("  Packing    %s\n",     Session->packing ? "on" : "off");
+	printf("  Pre-erase  %s\n",     Session->erasing ? "on" : "off");
+	printf("  Verify     %s\n",     Session->verifying ? "on" : "off");
+
+	if (Session->packetSize > 0)
+	{
+		printf("  Packet     %x\n", Session->packetSize);
+	}
+
+	if (Session->topology.depth > 0)
+	{
+		char topology[64];
+
+		printf("  Topology   %s\n", formatTopology(&Session->topology,
+		                                          topology, sizeof(topology)));
+		printf("  Speed      %s\n", labelLinkSpeed(Session->topology.speed));
+	}
+
+	if (Session->capabilities.bannerLength > 0)
+	{
+		printf("  Banner     %.*s\n", Session->capabilities.bannerLength,
+		       Session->capabilities.banner);
+	}
+
+	if (Session->geometry.pageSize || Session->geometry.sectorSize)
+	{
+		printf("  Flash ID   %08x\n", Session->geometry.flashID);
+		printf("  Page Size  %x\n",   Session->geometry.pageSize);
+		printf("  Sector     %x\n",   Session->geometry.sectorSize);
+		printf("  Flash Size %x\n",   Session->geometry.flashSize);
+	}
+
+	printf("\n");
 }
 
 static void serveOpenRequest()
 {
-	int result = -1;
+	Status = usxOpen(Session);
+}
+
+static void serveCloseRequest()
+{
+	Status = usxClose(Session);
+}
 
-	if (Handle != NULL)
+static void serveGreetRequest()
+{
+	struct Frame *banner = NULL;
+
+	if (usxGreet(Session, &banner) == -1)
 	{
-		fprintf(stderr, "Device already open\n\n");
+		Status = -1;
 		return;
 	}
 
-	Handle = libusb_open_device_with_vid_pid(NULL, Vendor, Product);
+	flushTrace();
+	dumpFrame(banner);
+	deallocateFrame(banner);
+}
+
+static void serveAwaitRequest(char *cursor)
+{
+	struct Frame *banner = NULL;
+	uint32_t timeout = 0;
+	double elapsed = 0;
+
+	skipSpace(&cursor);
 
-	if (Handle == NULL)
+	if (*cursor && parseUInt32(&cursor, &timeout) == -1)
 	{
-		fprintf(stderr, "Failed to open device\n\n");
+		fprintf(stderr, "Invalid timeout\n\n");
+		Status = -1;
 		return;
 	}
 
-	result = libusb_claim_interface(Handle, Interface);
-
-	if (result < 0)
+	if (Validating)
 	{
-		fprintf(stderr, "%s\n\n", libusb_strerror(result));
-		libusb_close(Handle);
-		Handle = NULL;
 		return;
 	}
 
-	result = libusb_control_transfer(Handle, 0x21, 34,
-	                                         Output << 8 | 1, 0,
-	                                         NULL, 0, Timeout);
-
-	if (result < 0)
+	if (usxAwait(Session, timeout, &banner, &elapsed) == -1)
 	{
-		fprintf(stderr, "%s\n\n", libusb_strerror(result));
-		libusb_release_interface(Handle, 0);
-		libusb_close(Handle);
-		Handle = NULL;
+		Status = -1;
 		return;
 	}
+
+	flushTrace();
+	dumpFrame(banner);
+	deallocateFrame(banner);
+	printf("  Arrival    %.1f ms to banner\n\n", elapsed * 1000);
 }
 
-static void serveCloseRequest()
+static void serveConnectRequest()
 {
-	if (Handle == NULL)
+	Status = usxConnect(Session);
+}
+
+static void serveResetRequest()
+{
+	Status = usxReset(Session);
+}
+
+static void serveFramingRequest(char *cursor)
+{
+	enum Framing framing = BootROMFraming;
+
+	if (matchToken(&cursor, "fdl") == 0)
 	{
-		fprintf(stderr, "Device not open\n\n");
+		framing = FDLFraming;
+	}
+
+	else if (matchToken(&cursor, "bootrom") != 0)
+	{
+		fprintf(stderr, "Invalid framing mode\n\n");
+		Status = -1;
 		return;
 	}
 
-	libusb_release_interface(Handle, 0);
-	libusb_close(Handle);
-	Handle = NULL;
+	if (!Validating)
+	{
+		Session->framing = framing;
+	}
 }
 
-static void serveGreetRequest()
+static void serveSendRequest(char *cursor)
 {
-	uint8_t request[] = { FRAME_DELIMITER };
-	struct Frame *response = NULL;
+	char *filename = NULL;
+	uint32_t address = 0;
 
-	if (transmit(request, sizeof(request)) == -1)
+	if (parseFilename(&cursor, &filename) == -1)
 	{
+		fprintf(stderr, "Invalid filename\n\n");
+		Status = -1;
 		return;
 	}
 
-	if (receiveFrame(receive, &response) == -1)
+	if (parseUInt32(&cursor, &address) == -1)
 	{
+		fprintf(stderr, "Invalid address\n\n");
+		Status = -1;
 		return;
 	}
 
-	dumpFrame(response);
+	if (Validating)
+	{
+		Status = checkImage(filename);
+		return;
+	}
 
-	if (response->type != Banner)
+	if (usxSend(Session, filename, address) == -1)
 	{
-		deallocateFrame(response);
+		Status = -1;
 		return;
 	}
 
-	deallocateFrame(response);
+	reportSend();
+
+	if (Session->packets > 0)
+	{
+		printf("  Packets    %u  %.1f%% full\n\n", Session->packets,
+		       100.0 * Session->wireBytes
+		       / ((double)Session->packets * Session->packetSize));
+	}
 }
 
-static void serveConnectRequest()
+static void serveScatterRequest(char *cursor)
 {
-	struct Frame  request  = { .type = Connect };
-	struct Frame *response = NULL;
+	char *filename = NULL;
+	struct Region *regions = NULL;
+	struct Segment *segments = NULL;
+	size_t count = 0;
+	unsigned transfers = 0;
 
-	if (Handle == NULL)
+	if (parseFilename(&cursor, &filename) == -1 || *filename == 0)
 	{
-		fprintf(stderr, "Device not open\n\n");
+		fprintf(stderr, "Invalid filename\n\n");
+		Status = -1;
+		return;
+	}
+
+	regions = loadLayout(filename, &count);
+
+	if (regions == NULL)
+	{
+		Status = -1;
 		return;
 	}
 
-	if (exchange(&request, &response) == -1)
+	segments = usxOpenRegions(regions, count);
+
+	if (segments == NULL)
 	{
+		destroyLayout(regions, count);
+		Status = -1;
 		return;
 	}
 
-	if (response->type != Acknowledgement)
+	if (Validating)
 	{
-		deallocateFrame(response);
+		showLayout(filename, regions, count);
+		usxCloseRegions(segments, count);
+		destroyLayout(regions, count);
 		return;
 	}
 
-	deallocateFrame(response);
+	Status = usxSendRegions(Session, regions, segments, count, &transfers);
+	usxCloseRegions(segments, count);
+
+	if (transfers > 0)
+	{
+		reportLayout(stdout, regions, count, transfers);
+	}
+
+	reportSend();
+	destroyLayout(regions, count);
 }
 
-static void serveResetRequest()
+static void serveBroadcastRequest(char *cursor)
 {
-	struct Frame  request  = { .type = Reset };
-	struct Frame *response = NULL;
+	struct Delivery deliveries[SESSION_COUNT];
+	char *filename = NULL;
+	uint32_t address = 0;
+	size_t count = 0;
+	unsigned failures = 0;
+	double elapsed = 0;
 
-	if (Handle == NULL)
+	if (parseFilename(&cursor, &filename) == -1)
 	{
-		fprintf(stderr, "Device not open\n\n");
+		fprintf(stderr, "Invalid filename\n\n");
+		Status = -1;
 		return;
 	}
 
-	if (exchange(&request, &response) == -1)
+	if (parseUInt32(&cursor, &address) == -1)
 	{
+		fprintf(stderr, "Invalid address\n\n");
+		Status = -1;
 		return;
 	}
 
-	if (response->type != Acknowledgement)
+	if (Validating)
 	{
-		deallocateFrame(response);
+		Status = checkImage(filename);
 		return;
 	}
 
-	deallocateFrame(response);
+	for (size_t index = 0; index < SESSION_COUNT; index++)
+	{
+		struct Session *session = Sessions[index];
+
+		if (session && session->link
+		 && (session == Session || claimSession(session) == 0))
+		{
+			deliveries[count++].session = session;
+		}
+	}
+
+	if (count == 0)
+	{
+		fprintf(stderr, "Device not open\n\n");
+		Status = -1;
+		return;
+	}
+
+	Status = usxBroadcast(deliveries, count, filename, address);
+
+	for (size_t index = 0; index < count; index++)
+	{
+		if (deliveries[index].session != Session)
+		{
+			releaseSession(deliveries[index].session);
+		}
+	}
+
+	if (Status == -1 && deliveries[0].elapsed == 0)
+	{
+		return;
+	}
+
+	for (size_t index = 0; index < count; index++)
+	{
+		struct Delivery *delivery = &deliveries[index];
+		unsigned number = 0;
+
+		while (Sessions[number] != delivery->session)
+		{
+			number++;
+		}
+
+		printf("  Session %-2u %-6s  %.3f s  shared %u bytes%s\n", number,
+		       delivery->result == 0 ? "sent" : "failed", delivery->elapsed,
+		       delivery->shared,
+		       delivery->evicted ? " (caught up privately)" : "");
+
+		if (delivery->session->verifiedBytes > 0)
+		{
+			printf("             verified %llu bytes  %u blocks rewritten\n",
+			       (unsigned long long)delivery->session->verifiedBytes,
+			       delivery->session->rewrites);
+		}
+
+		if (delivery->result == -1)
+		{
+			failures++;
+		}
+
+		if (delivery->elapsed > elapsed)
+		{
+			elapsed = delivery->elapsed;
+		}
+	}
+
+	printf("\n  Broadcast  %zu sessions  %u failed  %.3f s\n\n", count,
+	       failures, elapsed);
 }
 
-static void serveFramingRequest(char *cursor)
+static int checkImage(char *filename)
 {
-	if (matchToken(&cursor, "bootrom") == 0)
+	struct Image *image = openImage(filename);
+	uint32_t size = 0;
+
+	if (image == NULL)
 	{
-		selectBootROMFraming();
+		return -1;
 	}
 
-	else if (matchToken(&cursor, "fdl") == 0)
+	size = getImageSize(image);
+	closeImage(image);
+
+	if (size == 0)
 	{
-		selectFDLFraming();
+		fprintf(stderr, "%s: Empty image\n\n", filename);
+		return -1;
 	}
 
-	else
+	printf("  Image      %s  %x bytes\n\n", filename, size);
+	return 0;
+}
+
+static void showLayout(char *filename, struct Region *regions, size_t count)
+{
+	printf("  Layout     %s  %zu regions\n", filename, count);
+
+	for (size_t index = 0; index < count; index++)
 	{
-		fprintf(stderr, "Invalid framing mode\n\n");
+		printf("  Region     %08x  %8x bytes  %s+%x\n", regions[index].address,
+		       regions[index].length, regions[index].filename,
+		       regions[index].offset);
 	}
+
+	printf("\n");
 }
 
-static void serveSendRequest(char *cursor)
+static void reportSend(void)
+{
+	if (Session->erasures > 0)
+	{
+		printf("  Erased     %u ranges  %llu bytes\n\n", Session->erasures,
+		       (unsigned long long)Session->erasedBytes);
+	}
+
+	if (Session->verifiedBytes > 0)
+	{
+		printf("  Verified   %llu bytes  %u blocks rewritten\n\n",
+		       (unsigned long long)Session->verifiedBytes, Session->rewrites);
+	}
+}
+
+static void serveDumpRequest(char *cursor)
 {
 	char *filename = NULL;
 	uint32_t address = 0;
+	uint32_t size = 0;
 
 	if (parseFilename(&cursor, &filename) == -1)
 	{
 		fprintf(stderr, "Invalid filename\n\n");
+		Status = -1;
 		return;
 	}
 
 	if (parseUInt32(&cursor, &address) == -1)
 	{
 		fprintf(stderr, "Invalid address\n\n");
+		Status = -1;
 		return;
 	}
 
-	sendFile(filename, address);
+	if (parseUInt32(&cursor, &size) == -1)
+	{
+		fprintf(stderr, "Invalid size\n\n");
+		Status = -1;
+		return;
+	}
+
+	if (Validating)
+	{
+		return;
+	}
+
+	Status = usxDump(Session, filename, address, size);
 }
 
-static void serveExecuteRequest()
+static void serveEraseRequest(char *cursor)
 {
-	struct Frame  request  = { .type = ExecuteData, };
-	struct Frame *response = NULL;
+	uint32_t address = 0;
+	uint32_t size = 0;
+
+	if (parseUInt32(&cursor, &address) == -1)
+	{
+		fprintf(stderr, "Invalid address\n\n");
+		Status = -1;
+		return;
+	}
 
-	if (exchange(&request, &response) == -1)
+	if (parseUInt32(&cursor, &size) == -1 || size == 0)
 	{
+		fprintf(stderr, "Invalid size\n\n");
+		Status = -1;
 		return;
 	}
 
-	if (response->type != Acknowledgement)
+	if (Validating)
 	{
-		deallocateFrame(response);
 		return;
 	}
 
-	deallocateFrame(response);
+	Status = usxErase(Session, address, size);
+
+	if (Status == 0)
+	{
+		printf("  Erased     %u ranges  %llu bytes\n\n", Session->erasures,
+		       (unsigned long long)Session->erasedBytes);
+	}
 }
 
-static int sendFile(char *filename, uint32_t address)
+static void serveExecuteRequest()
 {
-	FILE *stream = NULL;
-	long remaining = 0;
-	uint8_t buffer[BlockSize * 2];
-	size_t length = 0;
+	Status = usxExecute(Session);
+}
 
-	stream = fopen(filename, "r");
+static void serveBootRequest()
+{
+	Status = usxBoot(Session, BootStages, BootStageCount);
+}
 
-	if (stream == NULL)
+static void serveBlockSizeRequest(char *cursor)
+{
+	uint16_t blockSize = 0;
+
+	if (parseUInt16(&cursor, &blockSize) == -1 || blockSize == 0)
 	{
-		fprintf(stderr, "%s\n\n", strerror(errno));
-		return -1;
+		fprintf(stderr, "Invalid block size\n\n");
+		Status = -1;
+		return;
 	}
 
-	remaining = determineFileSize(stream);
+	if (!Validating)
+	{
+		Session->blockSize = blockSize;
+	}
+}
 
-	if (remaining == -1)
+static void serveTuneRequest(char *cursor)
+{
+	struct Probe probes[16];
+	size_t count = sizeof(probes) / sizeof(*probes);
+	uint32_t address = 0;
+	uint16_t limit = UINT16_MAX;
+
+	if (parseUInt32(&cursor, &address) == -1)
 	{
-		fclose(stream);
-		return -1;
+		fprintf(stderr, "Invalid address\n\n");
+		Status = -1;
+		return;
 	}
 
-	if (startDataTransfer(address, remaining) == -1)
+	skipSpace(&cursor);
+
+	if (*cursor && (parseUInt16(&cursor, &limit) == -1 || limit == 0))
 	{
-		fclose(stream);
-		return -1;
+		fprintf(stderr, "Invalid limit\n\n");
+		Status = -1;
+		return;
 	}
 
-	while (remaining > 0)
+	if (Validating)
 	{
-		length = fread(buffer, 1, sizeof(buffer),stream);
+		return;
+	}
 
-		if (ferror(stream))
-		{
-			fprintf(stderr, "%s\n\n", strerror(errno));
-			fclose(stream);
-			return -1;
-		}
+	Status = usxTune(Session, address, limit, probes, &count);
+	flushTrace();
 
-		if (transferData(buffer, length) == -1)
-		{
-			fclose(stream);
-			return -1;
-		}
+	for (size_t index = 0; index < count; index++)
+	{
+		printf("  Block Size %04x  %8.1f KiB/s  %u frames  %u errors\n",
+		       probes[index].blockSize, probes[index].throughput / 1024,
+		       probes[index].frames, probes[index].errors);
+	}
 
-		remaining -= length;
+	if (Status == 0)
+	{
+		printf("\n  Selected   %04x\n", Session->blockSize);
 	}
 
-	if (endDataTransfer() == -1)
+	printf("\n");
+}
+
+static void serveSimulateRequest(char *cursor)
+{
+	struct Topology topology = { .speed = FullSpeed };
+	uint16_t maximum = 0;
+
+	if (parseSimulation(cursor, &maximum, &topology) == -1)
 	{
-		fclose(stream);
-		return -1;
+		Status = -1;
+		return;
 	}
 
-	fclose(stream);
-	return 0;
+	if (Validating)
+	{
+		return;
+	}
+
+	Status = usxSimulate(Session, maximum, &topology);
 }
 
-static long determineFileSize(FILE *stream)
+static void serveSerialRequest(char *cursor)
 {
-	long size = 0;
+	char *path = NULL;
+	char *token = NULL;
+	char *end = NULL;
+	unsigned long baud = SERIAL_DEFAULT_BAUD;
 
-	if (fseek(stream, 0, SEEK_END) == -1)
+	if (parseFilename(&cursor, &path) == -1 || *path == 0)
 	{
-		ERROR(strerror(errno));
-		return -1;
+		fprintf(stderr, "Invalid path\n\n");
+		Status = -1;
+		return;
 	}
 
-	size = ftell(stream);
+	skipSpace(&cursor);
 
-	if (size == -1)
+	if (*cursor)
 	{
-		ERROR(strerror(errno));
-		return -1;
+		parseFilename(&cursor, &token);
+		errno = 0;
+		baud = strtoul(token, &end, 10);
+
+		if (errno || *end || baud > UINT32_MAX)
+		{
+			fprintf(stderr, "Invalid baud rate\n\n");
+			Status = -1;
+			return;
+		}
 	}
 
-	if (fseek(stream, 0, SEEK_SET) == -1)
+	if (Validating)
 	{
-		ERROR(strerror(errno));
-		return -1;
+		return;
 	}
 
-	return size;
+	Status = usxSerial(Session, path, baud);
 }
 
-static int startDataTransfer(uint32_t destination, uint32_t size)
+static void serveArriveRequest(char *cursor)
 {
-	uint32_t data[] = { htonl(destination), htonl(size) };
+	struct Topology topology = { .speed = FullSpeed };
+	uint16_t maximum = 0;
+	uint32_t delay = 0;
 
-	struct Frame request =
+	if (parseUInt32(&cursor, &delay) == -1)
 	{
-		.type     = StartDataTransfer,
-		.dataSize = sizeof(data),
-		.data     = (uint8_t *)data
-	};
+		fprintf(stderr, "Invalid delay\n\n");
+		Status = -1;
+		return;
+	}
 
-	struct Frame *response = NULL;
+	if (parseSimulation(cursor, &maximum, &topology) == -1)
+	{
+		Status = -1;
+		return;
+	}
 
-	if (exchange(&request, &response) == -1)
+	if (Validating)
 	{
-		return -1;
+		return;
 	}
 
-	if (response->type != Acknowledgement)
+	Status = usxArrive(Session, delay, maximum, &topology);
+}
+
+static int parseSimulation(char *cursor, uint16_t *maximum,
+                           struct Topology *topology)
+{
+	char *token = NULL;
+
+	if (parseUInt16(&cursor, maximum) == -1 || *maximum == 0)
 	{
-		deallocateFrame(response);
+		fprintf(stderr, "Invalid maximum payload\n\n");
 		return -1;
 	}
 
-	deallocateFrame(response);
+	skipSpace(&cursor);
+
+	if (*cursor)
+	{
+		parseFilename(&cursor, &token);
+
+		if (parseTopology(token, topology) == -1)
+		{
+			fprintf(stderr, "Invalid topology\n\n");
+			return -1;
+		}
+
+		skipSpace(&cursor);
+	}
+
+	if (*cursor)
+	{
+		parseFilename(&cursor, &token);
+
+		if (parseLinkSpeed(token, &topology->speed) == -1)
+		{
+			fprintf(stderr, "Invalid speed\n\n");
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
-static int transferData(uint8_t *buffer, size_t size)
+static void serveSessionRequest(char *cursor)
 {
-	struct Frame request =
-	{
-		.type = DataTransfer,
-		.dataSize = size,
-		.data = buffer
-	};
+	uint16_t number = 0;
 
-	struct Frame *response = NULL;
+	if (parseUInt16(&cursor, &number) == -1 || number >= SESSION_COUNT)
+	{
+		fprintf(stderr, "Invalid session\n\n");
+		Status = -1;
+		return;
+	}
 
-	if (exchange(&request, &response) == -1)
+	if (Validating)
 	{
-		return -1;
+		return;
 	}
 
-	if (response->type != Acknowledgement)
+	if (Sessions[number] == NULL)
 	{
-		deallocateFrame(response);
-		return -1;
+		Sessions[number] = usxCreateSession();
+
+		if (Sessions[number] == NULL)
+		{
+			Status = -1;
+			return;
+		}
+
+		Sessions[number]->verbose = Session->verbose;
+		Sessions[number]->scheduler = Scheduler;
 	}
 
-	deallocateFrame(response);
-	return 0;
+	Current = number;
+	Session = Sessions[number];
 }
 
-static int endDataTransfer(void)
+static void serveJobsRequest()
 {
-	struct Frame  request  = { .type = EndDataTransfer };
-	struct Frame *response = NULL;
+	listJobs();
+}
+
+static void serveWaitRequest(char *cursor)
+{
+	uint16_t id = 0;
+
+	skipSpace(&cursor);
 
-	if (exchange(&request, &response) == -1)
+	if (*cursor && parseUInt16(&cursor, &id) == -1)
 	{
-		return -1;
+		fprintf(stderr, "Invalid job\n\n");
+		Status = -1;
+		return;
 	}
 
-	if (response->type != Acknowledgement)
+	if (!Validating)
 	{
-		deallocateFrame(response);
-		return -1;
+		Status = waitJob(id);
 	}
+}
 
-	deallocateFrame(response);
-	return 0;
+static void serveCancelRequest(char *cursor)
+{
+	uint16_t id = 0;
+
+	if (parseUInt16(&cursor, &id) == -1)
+	{
+		fprintf(stderr, "Invalid job\n\n");
+		Status = -1;
+		return;
+	}
+
+	if (!Validating)
+	{
+		Status = cancelJob(id);
+	}
 }
 
-static int exchange(struct Frame *request, struct Frame **response)
+static void serveScheduleRequest(char *cursor)
 {
-	if (transmitFrame(request, transmit) == -1)
+	struct Scheduler *scheduler = NULL;
+	bool enabled = false;
+
+	if (parseSwitch(&cursor, &enabled) == -1)
 	{
-		return -1;
+		fprintf(stderr, "Invalid schedule\n\n");
+		Status = -1;
+		return;
 	}
 
-	if (Verbose)
+	if (Validating)
 	{
-		dumpFrame(request);
+		return;
 	}
 
-	if (receiveFrame(receive, response) == -1)
+	for (size_t index = 0; index < SESSION_COUNT; index++)
 	{
-		return -1;
+		if (Sessions[index] && isSessionBusy(Sessions[index]))
+		{
+			fprintf(stderr, "Session busy\n\n");
+			Status = -1;
+			return;
+		}
 	}
 
-	if (Verbose)
+	if (enabled)
 	{
-		dumpFrame(*response);
+		if (Scheduler == NULL)
+		{
+			Scheduler = createScheduler();
+		}
+
+		scheduler = Scheduler;
 	}
 
-	return 0;
+	for (size_t index = 0; index < SESSION_COUNT; index++)
+	{
+		if (Sessions[index])
+		{
+			Sessions[index]->scheduler = scheduler;
+		}
+	}
 }
 
-static int transmit(uint8_t *buffer, size_t length)
+static void serveScheduleShowRequest()
 {
-	int result = 0;
-	int count = 0;
+	printf("  Schedule   %s\n", Session->scheduler ? "on" : "off");
 
-	if (Handle == NULL)
+	if (Scheduler)
 	{
-		fprintf(stderr, "Device not open\n\n");
-		return -1;
+		listLinks(Scheduler);
+	}
+
+	else
+	{
+		printf("\n");
+	}
+}
+
+static void serveLinkRequest(char *cursor)
+{
+	struct Topology link = { 0 };
+	uint32_t bandwidth = 0;
+	char *token = NULL;
+
+	parseFilename(&cursor, &token);
+
+	if (parseTopology(token, &link) == -1)
+	{
+		fprintf(stderr, "Invalid topology\n\n");
+		Status = -1;
+		return;
 	}
 
-	if (Verbose)
+	if (parseUInt32(&cursor, &bandwidth) == -1 || bandwidth == 0)
 	{
-		printf("TX\n");
-		dump(buffer, length, stdout);
+		fprintf(stderr, "Invalid bandwidth\n\n");
+		Status = -1;
+		return;
 	}
 
-	while (count < length)
+	if (Validating)
 	{
-		result = libusb_bulk_transfer(Handle, Output,
-		                              buffer + count,
-		                              length - count,
-		                              &count, Timeout);
+		return;
+	}
 
-		if (result < 0)
+	if (Scheduler == NULL)
+	{
+		Scheduler = createScheduler();
+
+		if (Scheduler == NULL)
 		{
-			fprintf(stderr, "%s\n\n", libusb_strerror(result));
-			return -1;
+			Status = -1;
+			return;
 		}
 	}
 
-	return 0;
+	setLinkBandwidth(Scheduler, &link, bandwidth);
 }
 
-static int receive(uint8_t *buffer, size_t size, int *length)
+static void servePackingRequest(char *cursor)
 {
-	if (Handle == NULL)
+	bool enabled = false;
+
+	if (parseSwitch(&cursor, &enabled) == -1)
 	{
-		fprintf(stderr, "Device not open\n\n");
-		return -1;
+		fprintf(stderr, "Invalid packing\n\n");
+		Status = -1;
+		return;
 	}
 
-	memset(buffer, 0, size);
+	if (!Validating)
+	{
+		Session->packing = enabled;
+	}
+}
 
-	int result = libusb_bulk_transfer(Handle, Input,
-	                                  buffer, size,
-	                                  length, Timeout);
+static void servePreEraseRequest(char *cursor)
+{
+	bool enabled = false;
 
-	if (result < 0)
+	if (parseSwitch(&cursor, &enabled) == -1)
 	{
-		fprintf(stderr, "%s\n\n", libusb_strerror(result));
-		return -1;
+		fprintf(stderr, "Invalid pre-erase\n\n");
+		Status = -1;
+		return;
 	}
 
-	if (Verbose)
+	if (!Validating)
 	{
-		printf("RX\n");
-		dump(buffer, *length, stdout);
-	}	
+		Session->erasing = enabled;
+	}
+}
 
-	return 0;
+static void serveVerifyRequest(char *cursor)
+{
+	bool enabled = false;
+
+	if (parseSwitch(&cursor, &enabled) == -1)
+	{
+		fprintf(stderr, "Invalid verify\n\n");
+		Status = -1;
+		return;
+	}
+
+	if (!Validating)
+	{
+		Session->verifying = enabled;
+	}
 }
 
-static void dump(uint8_t *buffer, size_t length, FILE *stream)
+static void serveRealTimeRequest(char *cursor)
 {
-	for (int offset = 0; offset < length; offset += 16)
+	bool enabled = false;
+	int core = -1;
+	uint16_t number = 0;
+
+	if (parseSwitch(&cursor, &enabled) == -1)
 	{
-		int remaining = 16;
+		fprintf(stderr, "Invalid real-time mode\n\n");
+		Status = -1;
+		return;
+	}
+
+	skipSpace(&cursor);
 
-		if (offset + 16 >= length)
+	if (enabled && *cursor)
+	{
+		if (parseUInt16(&cursor, &number) == -1)
 		{
-			remaining = length - offset;
+			fprintf(stderr, "Invalid core\n\n");
+			Status = -1;
+			return;
 		}
 
-		fprintf(stream, "  %08x: ", offset);
+		core = number;
+	}
 
-		for (int index = 0; index < 16; index++)
+	if (Validating)
+	{
+		return;
+	}
+
+	if (enabled)
+	{
+		Session->realTime.core = core;
+	}
+
+	Session->realTime.enabled = enabled;
+}
+
+static void serveGapsShowRequest()
+{
+	struct RealTime *realTime = &Session->realTime;
+	struct Gaps *gaps = &Session->gaps;
+
+	printf("  Real-Time  %s", realTime->enabled ? "on" : "off");
+
+	if (realTime->enabled)
+	{
+		printf("  %s  %s  %s",
+		       realTime->pinned ? "pinned" : "unpinned",
+		       realTime->scheduled ? "fifo" : "normal",
+		       realTime->locked ? "locked" : "unlocked");
+	}
+
+	printf("\n");
+
+	if (gaps->count == 0)
+	{
+		printf("\n");
+		return;
+	}
+
+	printf("  Gaps       %u  mean %.1f us  max %u us\n\n", gaps->count,
+	       gaps->total * 1e6 / gaps->count, gaps->maximum);
+
+	for (size_t bucket = 0; bucket < GAP_BUCKET_COUNT; bucket++)
+	{
+		if (gaps->buckets[bucket] == 0)
 		{
-			if (index < remaining)
-			{
-				uint8_t byte = buffer[offset + index];
-				fprintf(stream, "%02x", byte);
-			}
-
-			else
-			{
-				fprintf(stream, "  ");
-			}
-
-			if (index % 2)
-			{
-				fputc(' ', stream);
-			}
+			continue;
 		}
 
-		fputc(' ', stream);
-
-		for (int index = 0; index < remaining; index++)
+		if (bucket == GAP_BUCKET_COUNT - 1)
 		{
-			uint8_t byte = buffer[offset + index];
-			fputc(isprint(byte) ? byte : '.', stream);
+			printf("  %6u+      us  %u\n", 1u << bucket,
+			       gaps->buckets[bucket]);
 		}
 
-		fputc('\n', stream);
+		else
+		{
+			printf("  %6u-%-6u us  %u\n", bucket ? 1u << bucket : 0,
+			       (1u << (bucket + 1)) - 1, gaps->buckets[bucket]);
+		}
 	}
 
-	fputc('\n', stream);
+	printf("\n");
+}
+
+static void serveReportRequest()
+{
+	reportTelemetry(stdout);
 }
 
 static void cleanup(void)
 {
-	if (Handle != NULL)
+	cancelJobs();
+
+	for (size_t index = 0; index < SESSION_COUNT; index++)
 	{
-		libusb_release_interface(Handle, 0);
-		libusb_close(Handle);
-		Handle = NULL;
+		usxDestroySession(Sessions[index]);
+		Sessions[index] = NULL;
 	}
 
-	libusb_exit(NULL);
+	Session = NULL;
+	destroyScheduler(Scheduler);
+	Scheduler = NULL;
+	usxCleanup();
 }
@@ -7,6 +7,7 @@
 int parseUInt16(char **cursor, uint16_t *destination)
 {
 	unsigned long integer = 0;
+	char *start = NULL;
 
 	if (cursor == NULL)
 	{
@@ -19,9 +20,10 @@ int parseUInt16(char **cursor, uint16_t *destination)
 	}
 
 	errno = 0;
+	start = *cursor;
 	integer = strtoul(*cursor, cursor, 16);
 
-	if (errno)
+	if (errno || *cursor == start)
 	{
 		return -1;	
 	}
@@ -38,6 +40,7 @@ int parseUInt16(char **cursor, uint16_t *destination)
 int parseUInt32(char **cursor, uint32_t *destination)
 {
 	unsigned long integer = 0;
+	char *start = NULL;
 
 	if (cursor == NULL)
 	{
@@ -50,9 +53,10 @@ int parseUInt32(char **cursor, uint32_t *destination)
 	}
 
 	errno = 0;
+	start = *cursor;
 	integer = strtoul(*cursor, cursor, 16);
 
-	if (errno)
+	if (errno || *cursor == start)
 	{
 		return -1;	
 	}
@@ -99,6 +103,23 @@ int parseFilename(char **cursor, char **filename)
 	return 0;
 }
 
+int parseSwitch(char **cursor, bool *destination)
+{
+	if (matchToken(cursor, "on") == 0)
+	{
+		*destination = true;
+		return 0;
+	}
+
+	if (matchToken(cursor, "off") == 0)
+	{
+		*destination = false;
+		return 0;
+	}
+
+	return -1;
+}
+
 int matchToken(char **cursor, char *token)
 {
 	size_t length = 0;
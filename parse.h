@@ -1,11 +1,13 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 int parseUInt16(char **, uint16_t *);
 int parseUInt32(char **, uint32_t *);
 int parseFilename(char **, char **);
+int parseSwitch(char **, bool *);
 
 int matchToken(char **, char *);
 void skipSpace(char **);
@@ -0,0 +1,435 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+
+struct Slot
+{
+	atomic_size_t sequence;
+	struct Frame header;
+	uint8_t *buffer;
+	size_t length;
+};
+
+struct Pipeline
+{
+	struct Image *image;
+	enum Framing framing;
+	uint16_t payloadSize;
+	uint16_t leadingSize;
+	uint16_t packetSize;
+
+	struct Allocator allocator;
+	struct Slot slots[PIPELINE_SLOT_COUNT];
+	size_t taken;
+
+	pthread_mutex_t readLock;
+	uint32_t remaining;
+	size_t next;
+	uint8_t *pending;
+	size_t pendingLength;
+
+	pthread_mutex_t waitLock;
+	pthread_cond_t changed;
+	atomic_uint waiters;
+	atomic_bool failed;
+	atomic_bool cancelled;
+
+	pthread_t *workers;
+	unsigned workerCount;
+};
+
+static void *encode(void *);
+static ssize_t fillPayload(struct Pipeline *, uint8_t *, size_t);
+static size_t packPayload(struct Pipeline *, uint8_t *, size_t);
+static bool waitForSlot(struct Pipeline *, struct Slot *, size_t);
+static void signalPipeline(struct Pipeline *);
+static void failPipeline(struct Pipeline *);
+static void deallocatePipeline(struct Pipeline *);
+static uint8_t *allocateSlot(struct Pipeline *, size_t);
+static void releaseSlot(struct Pipeline *, uint8_t *, size_t);
+
+struct Pipeline *startPipeline(struct Image *image, enum Framing framing,
+                               uint16_t payloadSize, uint16_t leadingSize,
+                               uint16_t packetSize, unsigned workers,
+                               struct Allocator *allocator)
+{
+	struct Pipeline *pipeline = calloc(1, sizeof(struct Pipeline));
+
+	if (pipeline == NULL)
+	{
+		ERROR(strerror(errno));
+		return NULL;
+	}
+
+	pipeline->image = image;
+	pipeline->framing = framing;
+	pipeline->payloadSize = payloadSize;
+	pipeline->leadingSize = leadingSize;
+	pipeline->packetSize = packetSize;
+	pipeline->remaining = getImageSize(image);
+
+	if (allocator)
+	{
+		pipeline->allocator = *allocator;
+	}
+
+	pthread_mutex_init(&pipeline->readLock, NULL);
+	pthread_mutex_init(&pipeline->waitLock, NULL);
+	pthread_cond_init(&pipeline->changed, NULL);
+
+	if (packetSize > 0)
+	{
+		pipeline->pending = malloc(payloadSize);
+
+		if (pipeline->pending == NULL)
+		{
+			ERROR(strerror(errno));
+			deallocatePipeline(pipeline);
+			return NULL;
+		}
+	}
+
+	for (size_t index = 0; index < PIPELINE_SLOT_COUNT; index++)
+	{
+		struct Slot *slot = &pipeline->slots[index];
+
+		atomic_init(&slot->sequence, index * 2);
+		slot->buffer = allocateSlot(pipeline, MAXIMUM_FRAME_SIZE(payloadSize));
+
+		if (slot->buffer == NULL)
+		{
+			ERROR(strerror(errno));
+			deallocatePipeline(pipeline);
+			return NULL;
+		}
+	}
+
+	if (workers == 0)
+	{
+		workers = 1;
+	}
+
+	pipeline->workers = calloc(workers, sizeof(pthread_t));
+
+	if (pipeline->workers == NULL)
+	{
+		ERROR(strerror(errno));
+		deallocatePipeline(pipeline);
+		return NULL;
+	}
+
+	for (unsigned index = 0; index < workers; index++)
+	{
+		int result = pthread_create(&pipeline->workers[index], NULL,
+		                            encode, pipeline);
+
+		if (result != 0)
+		{
+			ERROR(strerror(result));
+			stopPipeline(pipeline);
+			return NULL;
+		}
+
+		pipeline->workerCount++;
+	}
+
+	return pipeline;
+}
+
+void stopPipeline(struct Pipeline *pipeline)
+{
+	if (pipeline == NULL)
+	{
+		return;
+	}
+
+	atomic_store(&pipeline->cancelled, true);
+	signalPipeline(pipeline);
+
+	for (unsigned index = 0; index < pipeline->workerCount; index++)
+	{
+		pthread_join(pipeline->workers[index], NULL);
+	}
+
+	deallocatePipeline(pipeline);
+}
+
+int takeFrame(struct Pipeline *pipeline, struct Frame *header,
+              uint8_t **buffer, size_t *length)
+{
+	size_t position = pipeline->taken;
+	struct Slot *slot = &pipeline->slots[position % PIPELINE_SLOT_COUNT];
+
+	if (!waitForSlot(pipeline, slot, position * 2 + 1))
+	{
+		return -1;
+	}
+
+	*header = slot->header;
+	*buffer = slot->buffer;
+	*length = slot->length;
+	return 0;
+}
+
+void releaseFrame(struct Pipeline *pipeline)
+{
+	size_t position = pipeline->taken++;
+	struct Slot *slot = &pipeline->slots[position % PIPELINE_SLOT_COUNT];
+
+	atomic_store_explicit(&slot->sequence,
+	                      (position + PIPELINE_SLOT_COUNT) * 2,
+	                      memory_order_release);
+	signalPipeline(pipeline);
+}
+
+static void *encode(void *argument)
+{
+	struct Pipeline *pipeline = argument;
+	uint8_t *data = malloc(pipeline->payloadSize);
+
+	if (data == NULL)
+	{
+		ERROR(strerror(errno));
+		failPipeline(pipeline);
+		return NULL;
+	}
+
+	for (;;)
+	{
+		struct Slot *slot = NULL;
+		struct Frame frame = { .type = DataTransfer, .data = data };
+		size_t position = 0;
+		ssize_t length = 0;
+
+		pthread_mutex_lock(&pipeline->readLock);
+
+		if (pipeline->remaining == 0)
+		{
+			pthread_mutex_unlock(&pipeline->readLock);
+			break;
+		}
+
+		position = pipeline->next;
+		slot = &pipeline->slots[position % PIPELINE_SLOT_COUNT];
+
+		if (!waitForSlot(pipeline, slot, position * 2))
+		{
+			pthread_mutex_unlock(&pipeline->readLock);
+			break;
+		}
+
+		length = pipeline->payloadSize;
+
+		if (position == 0 && pipeline->leadingSize > 0)
+		{
+			length = pipeline->leadingSize;
+		}
+
+		if (length > pipeline->remaining)
+		{
+			length = pipeline->remaining;
+		}
+
+		length = fillPayload(pipeline, data, length);
+
+		if (length <= 0)
+		{
+			pthread_mutex_unlock(&pipeline->readLock);
+			ERROR("Image ended early");
+			failPipeline(pipeline);
+			break;
+		}
+
+		pipeline->remaining -= length;
+		pipeline->next++;
+		pthread_mutex_unlock(&pipeline->readLock);
+
+		frame.dataSize = length;
+		slot->length = encodeFrame(pipeline->framing, &frame, slot->buffer);
+		slot->header = frame;
+		slot->header.data = NULL;
+
+		atomic_store_explicit(&slot->sequence, position * 2 + 1,
+		                      memory_order_release);
+		signalPipeline(pipeline);
+	}
+
+	free(data);
+	return NULL;
+}
+
+static ssize_t fillPayload(struct Pipeline *pipeline, uint8_t *data,
+                           size_t length)
+{
+	ssize_t result = 0;
+
+	if (pipeline->packetSize == 0)
+	{
+		return readImage(pipeline->image, data, length);
+	}
+
+	if (pipeline->pendingLength < length)
+	{
+		result = readImage(pipeline->image,
+		                   pipeline->pending + pipeline->pendingLength,
+		                   length - pipeline->pendingLength);
+
+		if (result > 0)
+		{
+			pipeline->pendingLength += result;
+		}
+	}
+
+	if (pipeline->pendingLength < length)
+	{
+		length = pipeline->pendingLength;
+	}
+
+	length = packPayload(pipeline, pipeline->pending, length);
+
+	memcpy(data, pipeline->pending, length);
+	memmove(pipeline->pending, pipeline->pending + length,
+	        pipeline->pendingLength - length);
+	pipeline->pendingLength -= length;
+
+	return length;
+}
+
+static size_t packPayload(struct Pipeline *pipeline, uint8_t *data,
+                          size_t length)
+{
+	size_t packetSize = pipeline->packetSize;
+	size_t encoded = PIPELINE_FRAME_OVERHEAD + length;
+	size_t boundary = 0;
+	size_t tail = 0;
+	size_t index = 0;
+
+	for (index = 0; index < length; index++)
+	{
+		encoded += data[index] == 0x7d || data[index] == 0x7e;
+	}
+
+	tail = encoded % packetSize;
+	boundary = encoded - tail;
+
+	if (tail == 0 || tail > packetSize / PIPELINE_PACKING_TAIL
+	 || boundary < packetSize || length >= pipeline->remaining)
+	{
+		return length;
+	}
+
+	encoded = PIPELINE_FRAME_OVERHEAD;
+
+	for (index = 0; index < length; index++)
+	{
+		encoded += data[index] == 0x7d || data[index] == 0x7e ? 2 : 1;
+
+		if (encoded > boundary)
+		{
+			break;
+		}
+	}
+
+	return index;
+}
+
+static bool waitForSlot(struct Pipeline *pipeline, struct Slot *slot,
+                        size_t sequence)
+{
+	if (atomic_load_explicit(&slot->sequence, memory_order_acquire)
+	    == sequence)
+	{
+		return true;
+	}
+
+	pthread_mutex_lock(&pipeline->waitLock);
+	atomic_fetch_add(&pipeline->waiters, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	while (atomic_load_explicit(&slot->sequence, memory_order_acquire)
+	       != sequence)
+	{
+		if (atomic_load(&pipeline->failed)
+		 || atomic_load(&pipeline->cancelled))
+		{
+			atomic_fetch_sub(&pipeline->waiters, 1);
+			pthread_mutex_unlock(&pipeline->waitLock);
+			return false;
+		}
+
+		pthread_cond_wait(&pipeline->changed, &pipeline->waitLock);
+	}
+
+	atomic_fetch_sub(&pipeline->waiters, 1);
+	pthread_mutex_unlock(&pipeline->waitLock);
+	return true;
+}
+
+static void signalPipeline(struct Pipeline *pipeline)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_load(&pipeline->waiters) == 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&pipeline->waitLock);
+	pthread_cond_broadcast(&pipeline->changed);
+	pthread_mutex_unlock(&pipeline->waitLock);
+}
+
+static void failPipeline(struct Pipeline *pipeline)
+{
+	atomic_store(&pipeline->failed, true);
+	signalPipeline(pipeline);
+}
+
+static void deallocatePipeline(struct Pipeline *pipeline)
+{
+	for (size_t index = 0; index < PIPELINE_SLOT_COUNT; index++)
+	{
+		if (pipeline->slots[index].buffer)
+		{
+			releaseSlot(pipeline, pipeline->slots[index].buffer,
+			            MAXIMUM_FRAME_SIZE(pipeline->payloadSize));
+		}
+	}
+
+	pthread_mutex_destroy(&pipeline->readLock);
+	pthread_mutex_destroy(&pipeline->waitLock);
+	pthread_cond_destroy(&pipeline->changed);
+
+	free(pipeline->pending);
+	free(pipeline->workers);
+	free(pipeline);
+}
+
+static uint8_t *allocateSlot(struct Pipeline *pipeline, size_t size)
+{
+	if (pipeline->allocator.allocate)
+	{
+		return pipeline->allocator.allocate(pipeline->allocator.context, size);
+	}
+
+	return malloc(size);
+}
+
+static void releaseSlot(struct Pipeline *pipeline, uint8_t *buffer, size_t size)
+{
+	if (pipeline->allocator.release)
+	{
+		pipeline->allocator.release(pipeline->allocator.context, buffer, size);
+	}
+
+	else
+	{
+		free(buffer);
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+#include "image.h"
+
+#define PIPELINE_SLOT_COUNT 32
+#define PIPELINE_FRAME_OVERHEAD 14
+#define PIPELINE_PACKING_TAIL 4
+
+struct Pipeline;
+
+struct Allocator
+{
+	uint8_t *(*allocate)(void *context, size_t size);
+	void (*release)(void *context, uint8_t *buffer, size_t size);
+	void *context;
+};
+
+struct Pipeline *startPipeline(struct Image *image, enum Framing framing,
+                               uint16_t payloadSize, uint16_t leadingSize,
+                               uint16_t packetSize, unsigned workers,
+                               struct Allocator *allocator);
+void stopPipeline(struct Pipeline *pipeline);
+
+int takeFrame(struct Pipeline *pipeline, struct Frame *header,
+              uint8_t **buffer, size_t *length);
+void releaseFrame(struct Pipeline *pipeline);
+
+#endif
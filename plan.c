@@ -0,0 +1,196 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parse.h"
+#include "plan.h"
+#include "system.h"
+#include "trace.h"
+
+struct Step
+{
+	unsigned line;
+	char text[PLAN_LINE_SIZE];
+};
+
+struct Plan
+{
+	char *name;
+	struct Step *steps;
+	size_t count;
+	size_t capacity;
+};
+
+static int readPlan(struct Plan *, FILE *, int (*)(char *));
+static int addStep(struct Plan *, unsigned, char *);
+static void reportStep(struct Plan *, unsigned, char *);
+
+struct Plan *loadPlan(char *filename, int (*check)(char *))
+{
+	struct Plan *plan = calloc(1, sizeof(struct Plan));
+	FILE *stream = stdin;
+	int result = 0;
+
+	if (plan == NULL)
+	{
+		ERROR(strerror(errno));
+		return NULL;
+	}
+
+	plan->name = filename;
+
+	if (strcmp(filename, "-") != 0)
+	{
+		stream = fopen(filename, "r");
+
+		if (stream == NULL)
+		{
+			fprintf(stderr, "%s: %s\n\n", filename, strerror(errno));
+			free(plan);
+			return NULL;
+		}
+	}
+
+	result = readPlan(plan, stream, check);
+
+	if (stream != stdin)
+	{
+		fclose(stream);
+	}
+
+	if (result == -1)
+	{
+		destroyPlan(plan);
+		return NULL;
+	}
+
+	return plan;
+}
+
+int runPlan(struct Plan *plan, int (*run)(char *))
+{
+	double start = measureTime();
+	char buffer[PLAN_LINE_SIZE];
+
+	for (size_t index = 0; index < plan->count; index++)
+	{
+		struct Step *step = &plan->steps[index];
+
+		printf("  Step %zu/%zu  %.*s\n\n", index + 1, plan->count,
+		       (int)strcspn(step->text, "\n"), step->text);
+		memcpy(buffer, step->text, sizeof(buffer));
+
+		if (run(buffer) == -1)
+		{
+			flushTrace();
+			reportStep(plan, step->line, "Step failed");
+			return -1;
+		}
+	}
+
+	flushTrace();
+	printf("  Plan       %zu steps  %.3f s\n\n", plan->count,
+	       measureTime() - start);
+	return 0;
+}
+
+void destroyPlan(struct Plan *plan)
+{
+	if (plan == NULL)
+	{
+		return;
+	}
+
+	free(plan->steps);
+	free(plan);
+}
+
+static int readPlan(struct Plan *plan, FILE *stream, int (*check)(char *))
+{
+	char buffer[PLAN_LINE_SIZE];
+	unsigned line = 0;
+	int result = 0;
+
+	while (fgets(buffer, sizeof(buffer), stream) != NULL)
+	{
+		char *cursor = buffer;
+		size_t length = strlen(buffer);
+
+		line++;
+
+		if (length == sizeof(buffer) - 1 && buffer[length - 1] != '\n')
+		{
+			reportStep(plan, line, "Line too long");
+			return -1;
+		}
+
+		if (length == 0 || buffer[length - 1] != '\n')
+		{
+			strcpy(buffer + length, "\n");
+		}
+
+		skipSpace(&cursor);
+
+		if (*cursor == 0 || *cursor == '#')
+		{
+			continue;
+		}
+
+		if (addStep(plan, line, cursor) == -1)
+		{
+			return -1;
+		}
+
+		if (check(cursor) == -1)
+		{
+			reportStep(plan, line, "Invalid step");
+			result = -1;
+		}
+	}
+
+	if (ferror(stream))
+	{
+		fprintf(stderr, "%s: %s\n\n", plan->name, strerror(errno));
+		return -1;
+	}
+
+	if (result == 0 && plan->count == 0)
+	{
+		fprintf(stderr, "%s: Empty plan\n\n", plan->name);
+		return -1;
+	}
+
+	return result;
+}
+
+static int addStep(struct Plan *plan, unsigned line, char *cursor)
+{
+	struct Step *step = NULL;
+
+	if (plan->count == plan->capacity)
+	{
+		size_t capacity = plan->capacity ? plan->capacity * 2 : 16;
+		struct Step *steps = realloc(plan->steps,
+		                             capacity * sizeof(struct Step));
+
+		if (steps == NULL)
+		{
+			ERROR(strerror(errno));
+			return -1;
+		}
+
+		plan->steps = steps;
+		plan->capacity = capacity;
+	}
+
+	step = &plan->steps[plan->count++];
+	step->line = line;
+	snprintf(step->text, sizeof(step->text), "%s", cursor);
+	return 0;
+}
+
+static void reportStep(struct Plan *plan, unsigned line, char *message)
+{
+	fprintf(stderr, "%s:%u: %s\n\n", plan->name, line, message);
+}
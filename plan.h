@@ -0,0 +1,12 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#define PLAN_LINE_SIZE 256
+
+struct Plan;
+
+struct Plan *loadPlan(char *filename, int (*check)(char *));
+int runPlan(struct Plan *plan, int (*run)(char *));
+void destroyPlan(struct Plan *plan);
+
+#endif
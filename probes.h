@@ -0,0 +1,38 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+enum ProbeState
+{
+	ProbeOpened,
+	ProbeClosed,
+	ProbeGreeted,
+	ProbeConnected
+};
+
+#ifdef HAVE_SYS_SDT_H
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PROBE_SEMAPHORE(name) \
+	unsigned short usx_##name##_semaphore \
+	__attribute__((unused, section(".probes")))
+
+#define PROBE_ENABLED(name) __builtin_expect(usx_##name##_semaphore, 0)
+
+#define PROBE3(name, a, b, c)    DTRACE_PROBE3(usx, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(usx, name, a, b, c, d)
+
+#else
+
+#define PROBE_SEMAPHORE(name) extern unsigned short usx_##name##_semaphore
+#define PROBE_ENABLED(name) 0
+
+#define PROBE3(name, a, b, c) \
+	do { (void)(a); (void)(b); (void)(c); } while (0)
+#define PROBE4(name, a, b, c, d) \
+	do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+
+#endif
+
+#endif
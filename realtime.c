@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "realtime.h"
+
+static _Thread_local cpu_set_t SavedAffinity;
+static _Thread_local struct sched_param SavedParameter;
+static _Thread_local int SavedPolicy;
+
+void enterRealTime(struct RealTime *realTime)
+{
+	pthread_t self = pthread_self();
+	struct sched_param parameter = { 0 };
+	cpu_set_t affinity;
+	int core = realTime->core;
+
+	realTime->pinned = false;
+	realTime->scheduled = false;
+
+	if (core >= 0
+	 && pthread_getaffinity_np(self, sizeof(SavedAffinity),
+	                           &SavedAffinity) == 0)
+	{
+		CPU_ZERO(&affinity);
+		CPU_SET(core, &affinity);
+
+		realTime->pinned = pthread_setaffinity_np(self, sizeof(affinity),
+		                                          &affinity) == 0;
+	}
+
+	if (pthread_getschedparam(self, &SavedPolicy, &SavedParameter) == 0)
+	{
+		parameter.sched_priority = sched_get_priority_min(SCHED_FIFO)
+		                         + REALTIME_PRIORITY;
+
+		realTime->scheduled = pthread_setschedparam(self, SCHED_FIFO,
+		                                            &parameter) == 0;
+	}
+}
+
+void leaveRealTime(struct RealTime *realTime)
+{
+	pthread_t self = pthread_self();
+
+	if (realTime->scheduled)
+	{
+		pthread_setschedparam(self, SavedPolicy, &SavedParameter);
+	}
+
+	if (realTime->pinned)
+	{
+		pthread_setaffinity_np(self, sizeof(SavedAffinity), &SavedAffinity);
+	}
+}
+
+bool lockMemory(void *buffer, size_t size)
+{
+	volatile uint8_t *bytes = buffer;
+	long page = sysconf(_SC_PAGESIZE);
+	bool locked = mlock(buffer, size) == 0;
+
+	for (size_t offset = 0; offset < size; offset += page)
+	{
+		bytes[offset] = bytes[offset];
+	}
+
+	return locked;
+}
+
+void unlockMemory(void *buffer, size_t size)
+{
+	munlock(buffer, size);
+}
+
+void resetGaps(struct Gaps *gaps)
+{
+	memset(gaps, 0, sizeof(*gaps));
+}
+
+void recordGap(struct Gaps *gaps, double seconds)
+{
+	uint32_t microseconds = seconds * 1e6;
+	size_t bucket = 0;
+
+	while (bucket < GAP_BUCKET_COUNT - 1 && microseconds >> (bucket + 1))
+	{
+		bucket++;
+	}
+
+	gaps->buckets[bucket]++;
+	gaps->count++;
+	gaps->total += seconds;
+
+	if (microseconds > gaps->maximum)
+	{
+		gaps->maximum = microseconds;
+	}
+}
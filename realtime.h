@@ -0,0 +1,37 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define REALTIME_PRIORITY 10
+#define GAP_BUCKET_COUNT 16
+
+struct RealTime
+{
+	bool enabled;
+	int core;
+
+	bool pinned;
+	bool scheduled;
+	bool locked;
+};
+
+struct Gaps
+{
+	uint32_t buckets[GAP_BUCKET_COUNT];
+	uint32_t count;
+	uint32_t maximum;
+	double total;
+};
+
+void enterRealTime(struct RealTime *realTime);
+void leaveRealTime(struct RealTime *realTime);
+bool lockMemory(void *buffer, size_t size);
+void unlockMemory(void *buffer, size_t size);
+
+void resetGaps(struct Gaps *gaps);
+void recordGap(struct Gaps *gaps, double seconds);
+
+#endif
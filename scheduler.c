@@ -0,0 +1,339 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+#include "scheduler.h"
+
+struct Link
+{
+	struct Topology prefix;
+	double capacity;
+	double demand;
+	unsigned active;
+	bool configured;
+};
+
+struct Scheduler
+{
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+
+	struct Link links[SCHEDULER_LINK_COUNT];
+	size_t linkCount;
+};
+
+static bool isAdmissible(struct Scheduler *, struct Topology *, double);
+static struct Link *findLink(struct Scheduler *, struct Topology *, uint8_t);
+
+struct Scheduler *createScheduler(void)
+{
+	struct Scheduler *scheduler = calloc(1, sizeof(struct Scheduler));
+
+	if (scheduler == NULL)
+	{
+		ERROR(strerror(errno));
+		return NULL;
+	}
+
+	pthread_mutex_init(&scheduler->lock, NULL);
+	pthread_cond_init(&scheduler->changed, NULL);
+	return scheduler;
+}
+
+void destroyScheduler(struct Scheduler *scheduler)
+{
+	if (scheduler)
+	{
+		pthread_mutex_destroy(&scheduler->lock);
+		pthread_cond_destroy(&scheduler->changed);
+		free(scheduler);
+	}
+}
+
+int setLinkBandwidth(struct Scheduler *scheduler, struct Topology *link,
+                     double bandwidth)
+{
+	struct Link *entry = NULL;
+
+	if (link->depth == 0 || bandwidth <= 0)
+	{
+		fprintf(stderr, "Invalid link\n\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&scheduler->lock);
+	entry = findLink(scheduler, link, link->depth);
+
+	if (entry)
+	{
+		entry->capacity = bandwidth;
+		entry->configured = true;
+		pthread_cond_broadcast(&scheduler->changed);
+	}
+
+	pthread_mutex_unlock(&scheduler->lock);
+
+	if (entry == NULL)
+	{
+		fprintf(stderr, "Too many links\n\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int acquireLink(struct Scheduler *scheduler, struct Topology *topology,
+                double demand, atomic_bool *cancelled)
+{
+	uint8_t count = countLinks(topology);
+
+	pthread_mutex_lock(&scheduler->lock);
+
+	while (!isAdmissible(scheduler, topology, demand))
+	{
+		if (cancelled && atomic_exchange(cancelled, false))
+		{
+			pthread_mutex_unlock(&scheduler->lock);
+			fprintf(stderr, "Cancelled\n\n");
+			return -1;
+		}
+
+		pthread_cond_wait(&scheduler->changed, &scheduler->lock);
+	}
+
+	for (uint8_t length = 1; length <= count; length++)
+	{
+		struct Link *link = findLink(scheduler, topology, length);
+
+		if (link)
+		{
+			link->active++;
+			link->demand += demand;
+		}
+	}
+
+	pthread_mutex_unlock(&scheduler->lock);
+	return 0;
+}
+
+void releaseLink(struct Scheduler *scheduler, struct Topology *topology,
+                 double demand)
+{
+	uint8_t count = countLinks(topology);
+
+	pthread_mutex_lock(&scheduler->lock);
+
+	for (uint8_t length = 1; length <= count; length++)
+	{
+		struct Link *link = findLink(scheduler, topology, length);
+
+		if (link && link->active > 0)
+		{
+			link->active--;
+			link->demand -= demand;
+		}
+	}
+
+	pthread_cond_broadcast(&scheduler->changed);
+	pthread_mutex_unlock(&scheduler->lock);
+}
+
+void wakeScheduler(struct Scheduler *scheduler)
+{
+	pthread_mutex_lock(&scheduler->lock);
+	pthread_cond_broadcast(&scheduler->changed);
+	pthread_mutex_unlock(&scheduler->lock);
+}
+
+void listLinks(struct Scheduler *scheduler)
+{
+	pthread_mutex_lock(&scheduler->lock);
+
+	for (size_t index = 0; index < scheduler->linkCount; index++)
+	{
+		struct Link *link = &scheduler->links[index];
+		char label[64];
+
+		printf("  Link %-12s %10.1f KiB/s %s  %u active  %10.1f KiB/s\n",
+		       formatTopology(&link->prefix, label, sizeof(label)),
+		       link->capacity / 1024,
+		       link->configured ? "set     " : "estimate",
+		       link->active, link->demand / 1024);
+	}
+
+	pthread_mutex_unlock(&scheduler->lock);
+	printf("\n");
+}
+
+uint8_t countLinks(struct Topology *topology)
+{
+	if (topology->depth <= 1)
+	{
+		return topology->depth;
+	}
+
+	return topology->depth - 1;
+}
+
+double estimateBandwidth(enum LinkSpeed speed)
+{
+	switch (speed)
+	{
+		case LowSpeed:
+			return 150000.0;
+
+		case FullSpeed:
+			return 1000000.0;
+
+		case HighSpeed:
+			return 40000000.0;
+
+		case SuperSpeed:
+			return 400000000.0;
+
+		case SuperSpeedPlus:
+			return 900000000.0;
+
+		default:
+			return 40000000.0;
+	}
+}
+
+int parseTopology(char *text, struct Topology *topology)
+{
+	char *cursor = text;
+	unsigned long value = strtoul(cursor, &cursor, 10);
+
+	memset(topology->ports, 0, sizeof(topology->ports));
+	topology->depth = 0;
+
+	if (cursor == text || *cursor != '-' || value > UINT8_MAX)
+	{
+		return -1;
+	}
+
+	topology->bus = value;
+
+	do
+	{
+		char *start = ++cursor;
+
+		value = strtoul(start, &cursor, 10);
+
+		if (cursor == start || value == 0 || value > UINT8_MAX
+		 || topology->depth == SCHEDULER_MAXIMUM_DEPTH)
+		{
+			return -1;
+		}
+
+		topology->ports[topology->depth++] = value;
+	}
+	while (*cursor == '.');
+
+	return *cursor == 0 || *cursor == ' ' || *cursor == '\n' ? 0 : -1;
+}
+
+char *formatTopology(struct Topology *topology, char *buffer, size_t size)
+{
+	int length = snprintf(buffer, size, "%u", topology->bus);
+
+	for (uint8_t index = 0; index < topology->depth && length < size; index++)
+	{
+		length += snprintf(buffer + length, size - length, "%c%u",
+		                   index ? '.' : '-', topology->ports[index]);
+	}
+
+	return buffer;
+}
+
+int parseLinkSpeed(char *text, enum LinkSpeed *speed)
+{
+	for (enum LinkSpeed candidate = LowSpeed; candidate <= SuperSpeedPlus;
+	     candidate++)
+	{
+		if (strcmp(text, labelLinkSpeed(candidate)) == 0)
+		{
+			*speed = candidate;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+char *labelLinkSpeed(enum LinkSpeed speed)
+{
+	static char *labels[] =
+	{
+		[UnknownSpeed]   = "unknown",
+		[LowSpeed]       = "low",
+		[FullSpeed]      = "full",
+		[HighSpeed]      = "high",
+		[SuperSpeed]     = "super",
+		[SuperSpeedPlus] = "super+"
+	};
+
+	return speed <= SuperSpeedPlus ? labels[speed] : "unknown";
+}
+
+static bool isAdmissible(struct Scheduler *scheduler,
+                         struct Topology *topology, double demand)
+{
+	uint8_t count = countLinks(topology);
+
+	for (uint8_t length = 1; length <= count; length++)
+	{
+		struct Link *link = findLink(scheduler, topology, length);
+
+		if (link == NULL)
+		{
+			continue;
+		}
+
+		if (!link->configured
+		 && estimateBandwidth(topology->speed) > link->capacity)
+		{
+			link->capacity = estimateBandwidth(topology->speed);
+		}
+
+		if (link->active > 0 && link->demand + demand > link->capacity)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static struct Link *findLink(struct Scheduler *scheduler,
+                             struct Topology *topology, uint8_t length)
+{
+	struct Link *link = NULL;
+
+	for (size_t index = 0; index < scheduler->linkCount; index++)
+	{
+		link = &scheduler->links[index];
+
+		if (link->prefix.bus == topology->bus && link->prefix.depth == length
+		 && memcmp(link->prefix.ports, topology->ports, length) == 0)
+		{
+			return link;
+		}
+	}
+
+	if (scheduler->linkCount == SCHEDULER_LINK_COUNT)
+	{
+		return NULL;
+	}
+
+	link = &scheduler->links[scheduler->linkCount++];
+	memset(link, 0, sizeof(*link));
+	link->prefix.bus = topology->bus;
+	link->prefix.depth = length;
+	memcpy(link->prefix.ports, topology->ports, length);
+	link->capacity = estimateBandwidth(topology->speed);
+	return link;
+}
@@ -0,0 +1,52 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCHEDULER_MAXIMUM_DEPTH 7
+#define SCHEDULER_LINK_COUNT 64
+#define SCHEDULER_DEFAULT_DEMAND 1048576.0
+
+enum LinkSpeed
+{
+	UnknownSpeed,
+	LowSpeed,
+	FullSpeed,
+	HighSpeed,
+	SuperSpeed,
+	SuperSpeedPlus
+};
+
+struct Topology
+{
+	uint8_t bus;
+	uint8_t depth;
+	uint8_t ports[SCHEDULER_MAXIMUM_DEPTH];
+	enum LinkSpeed speed;
+};
+
+struct Scheduler;
+
+struct Scheduler *createScheduler(void);
+void destroyScheduler(struct Scheduler *scheduler);
+
+int setLinkBandwidth(struct Scheduler *scheduler, struct Topology *link,
+                     double bandwidth);
+int acquireLink(struct Scheduler *scheduler, struct Topology *topology,
+                double demand, atomic_bool *cancelled);
+void releaseLink(struct Scheduler *scheduler, struct Topology *topology,
+                 double demand);
+void wakeScheduler(struct Scheduler *scheduler);
+void listLinks(struct Scheduler *scheduler);
+
+uint8_t countLinks(struct Topology *topology);
+double estimateBandwidth(enum LinkSpeed speed);
+int parseTopology(char *text, struct Topology *topology);
+char *formatTopology(struct Topology *topology, char *buffer, size_t size);
+int parseLinkSpeed(char *text, enum LinkSpeed *speed);
+char *labelLinkSpeed(enum LinkSpeed speed);
+
+#endif
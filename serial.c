@@ -0,0 +1,541 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "serial.h"
+#include "simulator.h"
+#include "system.h"
+
+struct Speed
+{
+	uint32_t baud;
+	speed_t constant;
+};
+
+struct Stream
+{
+	int descriptor;
+	uint8_t *buffer;
+	size_t head;
+	size_t tail;
+};
+
+struct Serial
+{
+	char path[PATH_MAX];
+	speed_t speed;
+	struct Stream stream;
+
+	bool loopback;
+	int master;
+	struct Simulator *simulator;
+	pthread_t thread;
+	atomic_bool serving;
+};
+
+static const struct Speed Speeds[] =
+{
+	{ 9600,    B9600 },
+	{ 19200,   B19200 },
+	{ 38400,   B38400 },
+	{ 57600,   B57600 },
+	{ 115200,  B115200 },
+	{ 230400,  B230400 },
+#ifdef B460800
+	{ 460800,  B460800 },
+#endif
+#ifdef B921600
+	{ 921600,  B921600 },
+#endif
+#ifdef B1000000
+	{ 1000000, B1000000 },
+#endif
+#ifdef B1500000
+	{ 1500000, B1500000 },
+#endif
+#ifdef B2000000
+	{ 2000000, B2000000 },
+#endif
+#ifdef B3000000
+	{ 3000000, B3000000 },
+#endif
+#ifdef B4000000
+	{ 4000000, B4000000 },
+#endif
+};
+
+static const size_t SpeedCount = sizeof(Speeds) / sizeof(*Speeds);
+
+static int openSerial(struct Session *);
+static void closeSerial(struct Session *);
+static int transmitToSerial(struct Session *, uint8_t *, size_t);
+static int receiveFromSerial(struct Session *, uint8_t *, size_t, int *);
+
+static int configureTerminal(int, speed_t);
+static int openLoopback(struct Serial *, struct Simulator *);
+static int startLoopback(struct Serial *);
+static void closeLoopback(struct Serial *);
+static void *serveLoopback(void *);
+static ssize_t fillStream(struct Stream *);
+static int extractFrame(struct Stream *, uint8_t *, size_t, int *);
+static int writeStream(int, uint8_t *, size_t, uint32_t, atomic_bool *);
+
+const struct Transport SerialTransport =
+{
+	.open     = openSerial,
+	.close    = closeSerial,
+	.transmit = transmitToSerial,
+	.receive  = receiveFromSerial
+};
+
+struct Serial *createSerial(char *path, uint32_t baud)
+{
+	struct Serial *serial = NULL;
+	size_t index = 0;
+
+	for (index = 0; index < SpeedCount; index++)
+	{
+		if (Speeds[index].baud == baud)
+		{
+			break;
+		}
+	}
+
+	if (index == SpeedCount)
+	{
+		fprintf(stderr, "Unsupported baud rate\n\n");
+		return NULL;
+	}
+
+	serial = calloc(1, sizeof(struct Serial));
+
+	if (serial == NULL)
+	{
+		ERROR(strerror(errno));
+		return NULL;
+	}
+
+	serial->stream.buffer = malloc(SERIAL_BUFFER_SIZE);
+
+	if (serial->stream.buffer == NULL)
+	{
+		ERROR(strerror(errno));
+		free(serial);
+		return NULL;
+	}
+
+	snprintf(serial->path, sizeof(serial->path), "%s", path);
+	serial->speed = Speeds[index].constant;
+	serial->loopback = strcmp(path, SERIAL_LOOPBACK) == 0;
+	serial->stream.descriptor = -1;
+	serial->master = -1;
+	return serial;
+}
+
+void destroySerial(struct Serial *serial)
+{
+	if (serial)
+	{
+		free(serial->stream.buffer);
+		free(serial);
+	}
+}
+
+static int openSerial(struct Session *session)
+{
+	struct Serial *serial = session->serial;
+	char *path = NULL;
+
+	if (serial == NULL)
+	{
+		fprintf(stderr, "No serial device\n\n");
+		return -1;
+	}
+
+	path = serial->path;
+
+	if (serial->loopback)
+	{
+		if (openLoopback(serial, session->simulator) == -1)
+		{
+			return -1;
+		}
+
+		path = ptsname(serial->master);
+	}
+
+	serial->stream.descriptor = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+	if (serial->stream.descriptor == -1)
+	{
+		fprintf(stderr, "%s: %s\n\n", path, strerror(errno));
+		closeLoopback(serial);
+		return -1;
+	}
+
+	if (configureTerminal(serial->stream.descriptor, serial->speed) == -1
+	 || (serial->loopback && startLoopback(serial) == -1))
+	{
+		close(serial->stream.descriptor);
+		serial->stream.descriptor = -1;
+		closeLoopback(serial);
+		return -1;
+	}
+
+	serial->stream.head = 0;
+	serial->stream.tail = 0;
+	session->packetSize = 0;
+	session->link = serial;
+	return 0;
+}
+
+static void closeSerial(struct Session *session)
+{
+	struct Serial *serial = session->link;
+
+	closeLoopback(serial);
+	close(serial->stream.descriptor);
+	serial->stream.descriptor = -1;
+	session->link = NULL;
+}
+
+static int transmitToSerial(struct Session *session,
+                            uint8_t *buffer, size_t length)
+{
+	struct Serial *serial = session->link;
+
+	return writeStream(serial->stream.descriptor, buffer, length,
+	                   session->timeout, &session->cancelled);
+}
+
+static int receiveFromSerial(struct Session *session,
+                             uint8_t *buffer, size_t size, int *length)
+{
+	struct Serial *serial = session->link;
+	struct Stream *stream = &serial->stream;
+	double deadline = measureTime() + session->timeout / 1000.0;
+
+	for (;;)
+	{
+		struct pollfd descriptor = { stream->descriptor, POLLIN, 0 };
+		double remaining = deadline - measureTime();
+		int result = extractFrame(stream, buffer, size, length);
+
+		if (result != 0)
+		{
+			return result > 0 ? 0 : -1;
+		}
+
+		if (atomic_exchange(&session->cancelled, false))
+		{
+			fprintf(stderr, "Cancelled\n\n");
+			return -1;
+		}
+
+		if (remaining <= 0)
+		{
+			fprintf(stderr, "Operation timed out\n\n");
+			return -1;
+		}
+
+		if (remaining > SERIAL_POLL_PERIOD / 1000.0)
+		{
+			remaining = SERIAL_POLL_PERIOD / 1000.0;
+		}
+
+		if (poll(&descriptor, 1, remaining * 1000 + 1) == -1
+		 && errno != EINTR)
+		{
+			fprintf(stderr, "%s\n\n", strerror(errno));
+			return -1;
+		}
+
+		if (fillStream(stream) == -1)
+		{
+			return -1;
+		}
+	}
+}
+
+static int configureTerminal(int descriptor, speed_t speed)
+{
+	struct termios attributes;
+
+	if (tcgetattr(descriptor, &attributes) == -1)
+	{
+		fprintf(stderr, "%s\n\n", strerror(errno));
+		return -1;
+	}
+
+	cfmakeraw(&attributes);
+	attributes.c_cflag |= CLOCAL | CREAD;
+	attributes.c_cflag &= ~(CSTOPB | CRTSCTS);
+	attributes.c_cc[VMIN] = 0;
+	attributes.c_cc[VTIME] = 0;
+
+	if (cfsetispeed(&attributes, speed) == -1
+	 || cfsetospeed(&attributes, speed) == -1
+	 || tcsetattr(descriptor, TCSANOW, &attributes) == -1)
+	{
+		fprintf(stderr, "%s\n\n", strerror(errno));
+		return -1;
+	}
+
+	tcflush(descriptor, TCIOFLUSH);
+	return 0;
+}
+
+static int openLoopback(struct Serial *serial, struct Simulator *simulator)
+{
+	if (simulator == NULL)
+	{
+		fprintf(stderr, "No simulated device\n\n");
+		return -1;
+	}
+
+	serial->master = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if (serial->master == -1
+	 || grantpt(serial->master) == -1
+	 || unlockpt(serial->master) == -1
+	 || fcntl(serial->master, F_SETFL, O_NONBLOCK) == -1)
+	{
+		fprintf(stderr, "%s\n\n", strerror(errno));
+		closeLoopback(serial);
+		return -1;
+	}
+
+	serial->simulator = simulator;
+	return 0;
+}
+
+static int startLoopback(struct Serial *serial)
+{
+	int result = 0;
+
+	atomic_store(&serial->serving, true);
+	result = pthread_create(&serial->thread, NULL, serveLoopback, serial);
+
+	if (result != 0)
+	{
+		ERROR(strerror(result));
+		atomic_store(&serial->serving, false);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void closeLoopback(struct Serial *serial)
+{
+	if (atomic_exchange(&serial->serving, false))
+	{
+		pthread_join(serial->thread, NULL);
+	}
+
+	if (serial->master != -1)
+	{
+		close(serial->master);
+		serial->master = -1;
+	}
+}
+
+static void *serveLoopback(void *argument)
+{
+	struct Serial *serial = argument;
+	struct Session device = { .simulator = serial->simulator };
+	struct Stream stream = { .descriptor = serial->master };
+	uint8_t *request = malloc(SERIAL_BUFFER_SIZE);
+	uint8_t *response = malloc(SERIAL_BUFFER_SIZE);
+
+	stream.buffer = malloc(SERIAL_BUFFER_SIZE);
+
+	if (request == NULL || response == NULL || stream.buffer == NULL
+	 || SimulatedTransport.open(&device) == -1)
+	{
+		free(stream.buffer);
+		free(response);
+		free(request);
+		return NULL;
+	}
+
+	while (atomic_load(&serial->serving))
+	{
+		struct pollfd descriptor = { stream.descriptor, POLLIN, 0 };
+		int length = 0;
+		int result = extractFrame(&stream, request, SERIAL_BUFFER_SIZE,
+		                          &length);
+
+		if (result == 0)
+		{
+			if (poll(&descriptor, 1, SERIAL_IDLE_PERIOD) > 0)
+			{
+				fillStream(&stream);
+				continue;
+			}
+
+			if (stream.tail == stream.head
+			 || stream.buffer[stream.tail - 1] != FRAME_DELIMITER)
+			{
+				continue;
+			}
+
+			stream.head = stream.tail;
+			request[0] = FRAME_DELIMITER;
+			length = 1;
+		}
+
+		else if (result == -1)
+		{
+			continue;
+		}
+
+		SimulatedTransport.transmit(&device, request, length);
+
+		if (SimulatedTransport.receive(&device, response, SERIAL_BUFFER_SIZE,
+		                               &length) == 0)
+		{
+			writeStream(stream.descriptor, response, length, 1000, NULL);
+		}
+	}
+
+	SimulatedTransport.close(&device);
+	free(stream.buffer);
+	free(response);
+	free(request);
+	return NULL;
+}
+
+static ssize_t fillStream(struct Stream *stream)
+{
+	ssize_t count = 0;
+
+	if (stream->head > 0)
+	{
+		memmove(stream->buffer, stream->buffer + stream->head,
+		        stream->tail - stream->head);
+		stream->tail -= stream->head;
+		stream->head = 0;
+	}
+
+	if (stream->tail == SERIAL_BUFFER_SIZE)
+	{
+		stream->tail = 0;
+		fprintf(stderr, "Overflow\n\n");
+		return -1;
+	}
+
+	count = read(stream->descriptor, stream->buffer + stream->tail,
+	             SERIAL_BUFFER_SIZE - stream->tail);
+
+	if (count == -1)
+	{
+		if (errno == EAGAIN || errno == EINTR)
+		{
+			return 0;
+		}
+
+		fprintf(stderr, "%s\n\n", strerror(errno));
+		return -1;
+	}
+
+	stream->tail += count;
+	return count;
+}
+
+static int extractFrame(struct Stream *stream, uint8_t *buffer, size_t size,
+                        int *length)
+{
+	uint8_t *data = stream->buffer;
+	size_t start = stream->head;
+	size_t end = 0;
+
+	while (start < stream->tail && data[start] != FRAME_DELIMITER)
+	{
+		start++;
+	}
+
+	while (start + 1 < stream->tail && data[start + 1] == FRAME_DELIMITER)
+	{
+		start++;
+	}
+
+	stream->head = start;
+
+	for (end = start + 1; end < stream->tail; end++)
+	{
+		if (data[end] == FRAME_DELIMITER)
+		{
+			break;
+		}
+	}
+
+	if (end >= stream->tail)
+	{
+		return 0;
+	}
+
+	stream->head = end + 1;
+
+	if (end - start + 1 > size)
+	{
+		fprintf(stderr, "Overflow\n\n");
+		return -1;
+	}
+
+	memcpy(buffer, data + start, end - start + 1);
+	*length = end - start + 1;
+	return 1;
+}
+
+static int writeStream(int descriptor, uint8_t *buffer, size_t length,
+                       uint32_t timeout, atomic_bool *cancelled)
+{
+	double deadline = measureTime() + timeout / 1000.0;
+	size_t count = 0;
+
+	while (count < length)
+	{
+		struct pollfd output = { descriptor, POLLOUT, 0 };
+		ssize_t written = write(descriptor, buffer + count, length - count);
+
+		if (written > 0)
+		{
+			count += written;
+			continue;
+		}
+
+		if (written == -1 && errno != EAGAIN && errno != EINTR)
+		{
+			fprintf(stderr, "%s\n\n", strerror(errno));
+			return -1;
+		}
+
+		if (cancelled && atomic_exchange(cancelled, false))
+		{
+			fprintf(stderr, "Cancelled\n\n");
+			return -1;
+		}
+
+		if (measureTime() >= deadline)
+		{
+			fprintf(stderr, "Operation timed out\n\n");
+			return -1;
+		}
+
+		poll(&output, 1, SERIAL_POLL_PERIOD);
+	}
+
+	return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+
+#include "usx.h"
+
+#define SERIAL_BUFFER_SIZE 65536
+#define SERIAL_POLL_PERIOD 100
+#define SERIAL_IDLE_PERIOD 10
+#define SERIAL_DEFAULT_BAUD 921600
+#define SERIAL_LOOPBACK "loopback"
+
+struct Serial;
+
+extern const struct Transport SerialTransport;
+
+struct Serial *createSerial(char *path, uint32_t baud);
+void destroySerial(struct Serial *serial);
+
+#endif
@@ -0,0 +1,577 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "simulator.h"
+
+#define SIMULATOR_FRAME_LATENCY 250000
+#define SIMULATOR_BYTE_LATENCY  100
+#define SIMULATOR_REWRITE_LATENCY 2000000
+#define SIMULATOR_ERASE_LATENCY 1000000
+#define SIMULATOR_PACKET_LATENCY 20000
+#define SIMULATOR_CONTENTION 0.25
+
+#define SIMULATOR_FLASH_ID    0x00c22016
+#define SIMULATOR_PAGE_SIZE   256
+#define SIMULATOR_SECTOR_SIZE 4096
+#define SIMULATOR_FLASH_SIZE  0x400000
+
+static char SimulatorBanner[] = "SPRD3";
+
+static pthread_mutex_t RegistryLock = PTHREAD_MUTEX_INITIALIZER;
+static struct Simulator *Registry = NULL;
+
+struct Simulator
+{
+	uint16_t maximumPayload;
+	enum Framing framing;
+	struct Topology topology;
+	uint16_t packetSize;
+	struct Simulator *next;
+
+	uint32_t address;
+	uint32_t size;
+	uint32_t received;
+	bool transferring;
+
+	uint32_t erasedAddress;
+	uint32_t erasedSize;
+	uint8_t *flash;
+
+	uint8_t *response;
+	size_t responseLength;
+};
+
+static int openSimulator(struct Session *);
+static void closeSimulator(struct Session *);
+static int transmitToSimulator(struct Session *, uint8_t *, size_t);
+static int receiveFromSimulator(struct Session *, uint8_t *, size_t, int *);
+
+static void serveFrame(struct Simulator *, struct Frame *);
+static void serveStartDataTransfer(struct Simulator *, struct Frame *);
+static void serveDataTransfer(struct Simulator *, struct Frame *);
+static void serveReadFlash(struct Simulator *, struct Frame *);
+static void serveEraseFlash(struct Simulator *, struct Frame *);
+static void accessFlash(struct Simulator *, uint32_t, uint8_t *, uint32_t,
+                        bool);
+static void serveReadFlashType(struct Simulator *);
+static void serveReadFlashInfo(struct Simulator *);
+static void respond(struct Simulator *, uint16_t, uint8_t *, uint16_t);
+static void registerSimulator(struct Simulator *);
+static void unregisterSimulator(struct Simulator *);
+static void setTransferring(struct Simulator *, bool);
+static uint64_t measureLinkDelay(struct Simulator *, size_t);
+static void delay(uint64_t);
+
+const struct Transport SimulatedTransport =
+{
+	.open     = openSimulator,
+	.close    = closeSimulator,
+	.transmit = transmitToSimulator,
+	.receive  = receiveFromSimulator
+};
+
+struct Simulator *createSimulator(uint16_t maximumPayload,
+                                  struct Topology *topology)
+{
+	struct Simulator *simulator = calloc(1, sizeof(struct Simulator));
+
+	if (simulator == NULL)
+	{
+		ERROR(strerror(errno));
+		return NULL;
+	}
+
+	simulator->maximumPayload = maximumPayload;
+	simulator->framing = BootROMFraming;
+
+	if (topology)
+	{
+		simulator->topology = *topology;
+	}
+
+	switch (simulator->topology.speed)
+	{
+		case LowSpeed:
+			simulator->packetSize = 8;
+			break;
+
+		case FullSpeed:
+			simulator->packetSize = 64;
+			break;
+
+		case SuperSpeed:
+		case SuperSpeedPlus:
+			simulator->packetSize = 1024;
+			break;
+
+		default:
+			simulator->packetSize = 512;
+			break;
+	}
+
+	return simulator;
+}
+
+void destroySimulator(struct Simulator *simulator)
+{
+	if (simulator)
+	{
+		free(simulator->response);
+		free(simulator->flash);
+		free(simulator);
+	}
+}
+
+static int openSimulator(struct Session *session)
+{
+	struct Simulator *simulator = session->simulator;
+
+	if (simulator == NULL)
+	{
+		fprintf(stderr, "No simulated device\n\n");
+		return -1;
+	}
+
+	simulator->framing = BootROMFraming;
+	simulator->transferring = false;
+	simulator->responseLength = 0;
+	registerSimulator(simulator);
+
+	session->topology = simulator->topology;
+	session->packetSize = simulator->packetSize;
+	session->link = simulator;
+	return 0;
+}
+
+static void closeSimulator(struct Session *session)
+{
+	unregisterSimulator(session->link);
+	session->link = NULL;
+}
+
+static int transmitToSimulator(struct Session *session,
+                               uint8_t *buffer, size_t length)
+{
+	struct Simulator *simulator = session->link;
+	struct Frame *frame = NULL;
+
+	if (length == 1 && buffer[0] == FRAME_DELIMITER)
+	{
+		respond(simulator, Banner, (uint8_t *)SimulatorBanner,
+		        sizeof(SimulatorBanner) - 1);
+		return 0;
+	}
+
+	delay(SIMULATOR_FRAME_LATENCY + measureLinkDelay(simulator, length)
+	      + (length + simulator->packetSize - 1) / simulator->packetSize
+	      * SIMULATOR_PACKET_LATENCY);
+
+	if (decodeFrame(simulator->framing, buffer, length, &frame) == -1)
+	{
+		respond(simulator, VerificationError, NULL, 0);
+		return 0;
+	}
+
+	serveFrame(simulator, frame);
+	deallocateFrame(frame);
+	return 0;
+}
+
+static int receiveFromSimulator(struct Session *session,
+                                uint8_t *buffer, size_t size, int *length)
+{
+	struct Simulator *simulator = session->link;
+
+	if (simulator->responseLength == 0)
+	{
+		delay((uint64_t)session->timeout * 1000000);
+		fprintf(stderr, "Operation timed out\n\n");
+		return -1;
+	}
+
+	if (simulator->responseLength > size)
+	{
+		fprintf(stderr, "Overflow\n\n");
+		simulator->responseLength = 0;
+		return -1;
+	}
+
+	memcpy(buffer, simulator->response, simulator->responseLength);
+	*length = simulator->responseLength;
+	simulator->responseLength = 0;
+	return 0;
+}
+
+static void serveFrame(struct Simulator *simulator, struct Frame *frame)
+{
+	switch (frame->type)
+	{
+		case StartDataTransfer:
+			serveStartDataTransfer(simulator, frame);
+			break;
+
+		case DataTransfer:
+			serveDataTransfer(simulator, frame);
+			break;
+
+		case EndDataTransfer:
+			setTransferring(simulator, false);
+			respond(simulator, Acknowledgement, NULL, 0);
+			break;
+
+		case ExecuteData:
+			respond(simulator, Acknowledgement, NULL, 0);
+			simulator->framing = FDLFraming;
+			break;
+
+		case ReadFlash:
+			serveReadFlash(simulator, frame);
+			break;
+
+		case EraseFlash:
+			serveEraseFlash(simulator, frame);
+			break;
+
+		case ReadFlashType:
+			serveReadFlashType(simulator);
+			break;
+
+		case ReadFlashInfo:
+			serveReadFlashInfo(simulator);
+			break;
+
+		default:
+			respond(simulator, Acknowledgement, NULL, 0);
+			break;
+	}
+}
+
+static void serveStartDataTransfer(struct Simulator *simulator,
+                                   struct Frame *frame)
+{
+	uint32_t data[2];
+
+	if (frame->dataSize < sizeof(data))
+	{
+		respond(simulator, SizeError, NULL, 0);
+		return;
+	}
+
+	memcpy(data, frame->data, sizeof(data));
+
+	simulator->address = ntohl(data[0]);
+	simulator->size = ntohl(data[1]);
+	simulator->received = 0;
+	setTransferring(simulator, true);
+
+	respond(simulator, Acknowledgement, NULL, 0);
+}
+
+static void serveDataTransfer(struct Simulator *simulator, struct Frame *frame)
+{
+	if (!simulator->transferring)
+	{
+		respond(simulator, DestinationError, NULL, 0);
+		return;
+	}
+
+	if (frame->dataSize > simulator->maximumPayload
+	 || simulator->received + frame->dataSize > simulator->size)
+	{
+		respond(simulator, SizeError, NULL, 0);
+		return;
+	}
+
+	if (simulator->framing == FDLFraming)
+	{
+		uint32_t start = simulator->address + simulator->received;
+		uint32_t end = start + frame->dataSize;
+
+		accessFlash(simulator, start, frame->data, frame->dataSize, true);
+
+		if (start - simulator->erasedAddress < simulator->erasedSize
+		 && end - simulator->erasedAddress <= simulator->erasedSize)
+		{
+			simulator->received += frame->dataSize;
+			respond(simulator, Acknowledgement, NULL, 0);
+			return;
+		}
+
+		if (start % SIMULATOR_SECTOR_SIZE)
+		{
+			delay(SIMULATOR_REWRITE_LATENCY);
+		}
+
+		if (end % SIMULATOR_SECTOR_SIZE
+		 && simulator->received + frame->dataSize < simulator->size)
+		{
+			delay(SIMULATOR_REWRITE_LATENCY);
+		}
+	}
+
+	simulator->received += frame->dataSize;
+	respond(simulator, Acknowledgement, NULL, 0);
+}
+
+static void serveReadFlash(struct Simulator *simulator, struct Frame *frame)
+{
+	uint32_t data[3] = { 0 };
+	uint32_t length = 0;
+	uint8_t *contents = NULL;
+
+	if (frame->dataSize < 2 * sizeof(uint32_t))
+	{
+		respond(simulator, SizeError, NULL, 0);
+		return;
+	}
+
+	memcpy(data, frame->data, frame->dataSize < sizeof(data) ? frame->dataSize
+	                                                         : sizeof(data));
+	length = ntohl(data[1]);
+
+	if (length > simulator->maximumPayload)
+	{
+		respond(simulator, SizeError, NULL, 0);
+		return;
+	}
+
+	delay(measureLinkDelay(simulator, length));
+	contents = calloc(1, length);
+
+	if (contents == NULL)
+	{
+		respond(simulator, SizeError, NULL, 0);
+		return;
+	}
+
+	accessFlash(simulator, ntohl(data[0]) + ntohl(data[2]), contents, length,
+	            false);
+	respond(simulator, ReadFlashResponse, contents, length);
+	free(contents);
+}
+
+static void serveEraseFlash(struct Simulator *simulator, struct Frame *frame)
+{
+	uint32_t data[2];
+
+	if (simulator->framing != FDLFraming)
+	{
+		respond(simulator, DestinationError, NULL, 0);
+		return;
+	}
+
+	if (frame->dataSize < sizeof(data))
+	{
+		respond(simulator, SizeError, NULL, 0);
+		return;
+	}
+
+	memcpy(data, frame->data, sizeof(data));
+	simulator->erasedAddress = ntohl(data[0]);
+	simulator->erasedSize = ntohl(data[1]);
+
+	if (simulator->erasedAddress % SIMULATOR_SECTOR_SIZE
+	 || simulator->erasedSize % SIMULATOR_SECTOR_SIZE)
+	{
+		simulator->erasedSize = 0;
+		respond(simulator, SizeError, NULL, 0);
+		return;
+	}
+
+	if (simulator->flash)
+	{
+		for (uint32_t offset = 0; offset < simulator->erasedSize;
+		     offset += SIMULATOR_SECTOR_SIZE)
+		{
+			memset(simulator->flash + (simulator->erasedAddress + offset)
+			       % SIMULATOR_FLASH_SIZE, 0xff, SIMULATOR_SECTOR_SIZE);
+		}
+	}
+
+	delay((uint64_t)simulator->erasedSize / SIMULATOR_SECTOR_SIZE
+	      * SIMULATOR_ERASE_LATENCY);
+	respond(simulator, Acknowledgement, NULL, 0);
+}
+
+static void accessFlash(struct Simulator *simulator, uint32_t address,
+                        uint8_t *data, uint32_t length, bool writing)
+{
+	if (simulator->flash == NULL && writing)
+	{
+		simulator->flash = calloc(1, SIMULATOR_FLASH_SIZE);
+	}
+
+	if (simulator->flash == NULL)
+	{
+		return;
+	}
+
+	for (uint32_t offset = 0; offset < length; )
+	{
+		uint32_t position = (address + offset) % SIMULATOR_FLASH_SIZE;
+		uint32_t chunk = SIMULATOR_FLASH_SIZE - position;
+
+		if (chunk > length - offset)
+		{
+			chunk = length - offset;
+		}
+
+		if (writing)
+		{
+			memcpy(simulator->flash + position, data + offset, chunk);
+		}
+
+		else
+		{
+			memcpy(data + offset, simulator->flash + position, chunk);
+		}
+
+		offset += chunk;
+	}
+}
+
+static void serveReadFlashType(struct Simulator *simulator)
+{
+	uint32_t data[] = { htonl(SIMULATOR_FLASH_ID) };
+
+	if (simulator->framing != FDLFraming)
+	{
+		respond(simulator, DestinationError, NULL, 0);
+		return;
+	}
+
+	respond(simulator, ReadFlashResponse, (uint8_t *)data, sizeof(data));
+}
+
+static void serveReadFlashInfo(struct Simulator *simulator)
+{
+	uint32_t data[] =
+	{
+		htonl(SIMULATOR_PAGE_SIZE),
+		htonl(SIMULATOR_SECTOR_SIZE),
+		htonl(SIMULATOR_FLASH_SIZE)
+	};
+
+	if (simulator->framing != FDLFraming)
+	{
+		respond(simulator, DestinationError, NULL, 0);
+		return;
+	}
+
+	respond(simulator, ReadFlashResponse, (uint8_t *)data, sizeof(data));
+}
+
+static void respond(struct Simulator *simulator, uint16_t type,
+                    uint8_t *data, uint16_t dataSize)
+{
+	struct Frame frame =
+	{
+		.type     = type,
+		.dataSize = dataSize,
+		.data     = data
+	};
+
+	uint8_t *response = realloc(simulator->response,
+	                            MAXIMUM_FRAME_SIZE(dataSize));
+
+	if (response == NULL)
+	{
+		ERROR(strerror(errno));
+		simulator->responseLength = 0;
+		return;
+	}
+
+	simulator->response = response;
+	simulator->responseLength = encodeFrame(simulator->framing, &frame,
+	                                        response);
+}
+
+static void registerSimulator(struct Simulator *simulator)
+{
+	pthread_mutex_lock(&RegistryLock);
+	simulator->next = Registry;
+	Registry = simulator;
+	pthread_mutex_unlock(&RegistryLock);
+}
+
+static void unregisterSimulator(struct Simulator *simulator)
+{
+	pthread_mutex_lock(&RegistryLock);
+
+	for (struct Simulator **entry = &Registry; *entry;
+	     entry = &(*entry)->next)
+	{
+		if (*entry == simulator)
+		{
+			*entry = simulator->next;
+			break;
+		}
+	}
+
+	simulator->transferring = false;
+	pthread_mutex_unlock(&RegistryLock);
+}
+
+static void setTransferring(struct Simulator *simulator, bool transferring)
+{
+	pthread_mutex_lock(&RegistryLock);
+	simulator->transferring = transferring;
+	pthread_mutex_unlock(&RegistryLock);
+}
+
+static uint64_t measureLinkDelay(struct Simulator *simulator, size_t length)
+{
+	struct Topology *topology = &simulator->topology;
+	uint64_t nanoseconds = (uint64_t)length * SIMULATOR_BYTE_LATENCY;
+	uint8_t count = countLinks(topology);
+
+	pthread_mutex_lock(&RegistryLock);
+
+	for (uint8_t depth = 1; depth <= count; depth++)
+	{
+		double bandwidth = estimateBandwidth(topology->speed);
+		unsigned sharing = 1;
+		uint64_t link = 0;
+
+		for (struct Simulator *peer = Registry; peer; peer = peer->next)
+		{
+			if (peer != simulator && peer->transferring
+			 && peer->topology.bus == topology->bus
+			 && countLinks(&peer->topology) >= depth
+			 && memcmp(peer->topology.ports, topology->ports, depth) == 0)
+			{
+				sharing++;
+			}
+		}
+
+		bandwidth /= sharing * (1 + SIMULATOR_CONTENTION * (sharing - 1));
+		link = length / bandwidth * 1e9;
+
+		if (link > nanoseconds)
+		{
+			nanoseconds = link;
+		}
+	}
+
+	pthread_mutex_unlock(&RegistryLock);
+	return nanoseconds;
+}
+
+static void delay(uint64_t nanoseconds)
+{
+	struct timespec period =
+	{
+		.tv_sec  = nanoseconds / 1000000000,
+		.tv_nsec = nanoseconds % 1000000000
+	};
+
+	while (nanosleep(&period, &period) == -1 && errno == EINTR)
+	{
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "usx.h"
+
+struct Simulator;
+
+extern const struct Transport SimulatedTransport;
+
+struct Simulator *createSimulator(uint16_t maximumPayload,
+                                  struct Topology *topology);
+void destroySimulator(struct Simulator *simulator);
+
+#endif
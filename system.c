@@ -0,0 +1,80 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "frame.h"
+#include "system.h"
+
+double measureTime(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int locateFile(char *path, size_t size, char *override, char *base,
+               char *fallback, char *name)
+{
+	char *explicit = getenv(override);
+	char *directory = getenv(base);
+	char *home = getenv("HOME");
+	int length = 0;
+
+	if (explicit && *explicit)
+	{
+		length = snprintf(path, size, "%s", explicit);
+	}
+
+	else if (directory && *directory)
+	{
+		length = snprintf(path, size, "%s/usx/%s", directory, name);
+	}
+
+	else if (home && *home)
+	{
+		length = snprintf(path, size, "%s/%s/usx/%s", home, fallback, name);
+	}
+
+	else
+	{
+		return -1;
+	}
+
+	if (length < 0 || length >= size)
+	{
+		ERROR("Path too long");
+		return -1;
+	}
+
+	return 0;
+}
+
+int makeDirectories(char *path)
+{
+	char directory[PATH_MAX];
+
+	snprintf(directory, sizeof(directory), "%s", path);
+
+	for (char *cursor = directory + 1; *cursor; cursor++)
+	{
+		if (*cursor == '/')
+		{
+			*cursor = 0;
+
+			if (mkdir(directory, 0755) == -1 && errno != EEXIST)
+			{
+				ERROR(strerror(errno));
+				return -1;
+			}
+
+			*cursor = '/';
+		}
+	}
+
+	return 0;
+}
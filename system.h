@@ -0,0 +1,12 @@
+#ifndef SYSTEM_H
+#define SYSTEM_H
+
+#include <stddef.h>
+
+double measureTime(void);
+
+int locateFile(char *path, size_t size, char *override, char *base,
+               char *fallback, char *name);
+int makeDirectories(char *path);
+
+#endif
@@ -0,0 +1,414 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+#include "system.h"
+#include "telemetry.h"
+
+struct Entry
+{
+	struct TelemetryRecord record;
+	bool slow;
+};
+
+static int parseRecord(char *, struct Entry *);
+static void formatRecord(FILE *, struct TelemetryRecord *);
+static size_t summariseGroups(FILE *, struct Entry *, size_t, bool);
+static double findMedian(struct Entry *, size_t);
+static int comparePorts(const void *, const void *);
+static int compareModels(const void *, const void *);
+static int compareRates(const void *, const void *);
+static int compareSamples(const void *, const void *);
+
+void resetTelemetry(struct Telemetry *telemetry, double now)
+{
+	memset(telemetry, 0, sizeof(*telemetry));
+	telemetry->opened = now;
+	telemetry->seed = (unsigned)(now * 1e6);
+}
+
+void recordRoundTrip(struct Telemetry *telemetry, double seconds)
+{
+	uint32_t microseconds = seconds * 1e6;
+
+	if (telemetry->sampleCount < TELEMETRY_SAMPLE_COUNT)
+	{
+		telemetry->samples[telemetry->sampleCount] = microseconds;
+	}
+
+	else
+	{
+		uint32_t index = rand_r(&telemetry->seed)
+		               % (telemetry->sampleCount + 1);
+
+		if (index < TELEMETRY_SAMPLE_COUNT)
+		{
+			telemetry->samples[index] = microseconds;
+		}
+	}
+
+	telemetry->sampleCount++;
+}
+
+void recordPhase(struct Telemetry *telemetry, enum TelemetryPhase phase,
+                 uint64_t bytes, double seconds)
+{
+	telemetry->bytes[phase] += bytes;
+	telemetry->seconds[phase] += seconds;
+}
+
+void summariseTelemetry(struct Telemetry *telemetry, double now,
+                        struct TelemetryRecord *record)
+{
+	static const unsigned percentiles[] = { 50, 90, 99 };
+	uint32_t samples[TELEMETRY_SAMPLE_COUNT];
+	size_t count = telemetry->sampleCount;
+	double seconds = 0;
+
+	memset(record, 0, sizeof(*record));
+	record->time = time(NULL);
+	record->frames = telemetry->frames;
+	record->retries = telemetry->retries;
+	record->duration = now - telemetry->opened;
+
+	if (count > TELEMETRY_SAMPLE_COUNT)
+	{
+		count = TELEMETRY_SAMPLE_COUNT;
+	}
+
+	memcpy(samples, telemetry->samples, count * sizeof(*samples));
+	qsort(samples, count, sizeof(*samples), compareSamples);
+
+	for (size_t index = 0; index < 3 && count > 0; index++)
+	{
+		record->roundTrip[index] = samples[(count - 1) * percentiles[index]
+		                                   / 100];
+	}
+
+	for (size_t phase = 0; phase < TELEMETRY_PHASE_COUNT; phase++)
+	{
+		record->bytes += telemetry->bytes[phase];
+		seconds += telemetry->seconds[phase];
+
+		if (telemetry->seconds[phase] > 0)
+		{
+			record->rate[phase] = telemetry->bytes[phase]
+			                    / telemetry->seconds[phase] / 1e6;
+		}
+	}
+
+	if (seconds > 0)
+	{
+		record->total = record->bytes / seconds / 1e6;
+	}
+}
+
+int appendTelemetry(struct TelemetryRecord *record)
+{
+	char path[PATH_MAX];
+	FILE *stream = NULL;
+
+	if (locateFile(path, sizeof(path), "USX_TELEMETRY",
+	               "XDG_STATE_HOME", ".local/state", "telemetry") == -1)
+	{
+		return -1;
+	}
+
+	if (makeDirectories(path) == -1)
+	{
+		return -1;
+	}
+
+	stream = fopen(path, "a");
+
+	if (stream == NULL)
+	{
+		ERROR(strerror(errno));
+		return -1;
+	}
+
+	formatRecord(stream, record);
+
+	if (fclose(stream) == EOF)
+	{
+		ERROR(strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int reportTelemetry(FILE *output)
+{
+	char path[PATH_MAX];
+	char line[BUFSIZ];
+	struct Entry *entries = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	FILE *stream = NULL;
+
+	if (locateFile(path, sizeof(path), "USX_TELEMETRY",
+	               "XDG_STATE_HOME", ".local/state", "telemetry") == -1)
+	{
+		return -1;
+	}
+
+	stream = fopen(path, "r");
+
+	if (stream == NULL)
+	{
+		fprintf(stderr, "%s: %s\n\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), stream))
+	{
+		if (count == capacity)
+		{
+			size_t size = capacity ? capacity * 2 : 64;
+			struct Entry *resized = realloc(entries, size * sizeof(*entries));
+
+			if (resized == NULL)
+			{
+				ERROR(strerror(errno));
+				free(entries);
+				fclose(stream);
+				return -1;
+			}
+
+			entries = resized;
+			capacity = size;
+		}
+
+		if (parseRecord(line, &entries[count]) == 0)
+		{
+			count++;
+		}
+	}
+
+	fclose(stream);
+
+	if (count == 0)
+	{
+		fprintf(output, "  No sessions recorded\n\n");
+		free(entries);
+		return 0;
+	}
+
+	summariseGroups(output, entries, count, false);
+
+	if (summariseGroups(output, entries, count, true) > 0)
+	{
+		for (size_t index = 0; index < count; index++)
+		{
+			struct Entry *entry = &entries[index];
+			char label[32];
+
+			if (!entry->slow)
+			{
+				continue;
+			}
+
+			strftime(label, sizeof(label), "%Y-%m-%d %H:%M:%S",
+			         localtime(&entry->record.time));
+			fprintf(output, "  Slow       %s  %-12s %-16s %8.3f MB/s"
+			        "  %u retries  p99 %u us\n",
+			        label, entry->record.port, entry->record.model,
+			        entry->record.total, entry->record.retries,
+			        entry->record.roundTrip[2]);
+		}
+
+		fprintf(output, "\n");
+	}
+
+	free(entries);
+	return 0;
+}
+
+static int parseRecord(char *line, struct Entry *entry)
+{
+	struct TelemetryRecord *record = &entry->record;
+	unsigned int vendor = 0;
+	unsigned int product = 0;
+	long long stamp = 0;
+	unsigned long long bytes = 0;
+
+	memset(entry, 0, sizeof(*entry));
+
+	if (sscanf(line, "%lld %x %x %x %63s %31s %llu %u %u %u %u %u "
+	           "%lf %lf %lf %lf %lf",
+	           &stamp, &vendor, &product, &record->flashID,
+	           record->model, record->port, &bytes,
+	           &record->frames, &record->retries,
+	           &record->roundTrip[0], &record->roundTrip[1],
+	           &record->roundTrip[2], &record->total,
+	           &record->rate[BootROMPhase], &record->rate[FDLPhase],
+	           &record->rate[DumpPhase], &record->duration) != 17)
+	{
+		return -1;
+	}
+
+	if (vendor > UINT16_MAX || product > UINT16_MAX)
+	{
+		return -1;
+	}
+
+	record->time = stamp;
+	record->vendor = vendor;
+	record->product = product;
+	record->bytes = bytes;
+	return 0;
+}
+
+static void formatRecord(FILE *stream, struct TelemetryRecord *record)
+{
+	fprintf(stream, "%lld %04x %04x %08x %s %s %llu %u %u %u %u %u "
+	        "%.3f %.3f %.3f %.3f %.3f\n",
+	        (long long)record->time, record->vendor, record->product,
+	        record->flashID, *record->model ? record->model : "-",
+	        *record->port ? record->port : "-",
+	        (unsigned long long)record->bytes, record->frames,
+	        record->retries, record->roundTrip[0], record->roundTrip[1],
+	        record->roundTrip[2], record->total, record->rate[BootROMPhase],
+	        record->rate[FDLPhase], record->rate[DumpPhase],
+	        record->duration);
+}
+
+static size_t summariseGroups(FILE *output, struct Entry *entries,
+                              size_t count, bool ports)
+{
+	size_t slow = 0;
+
+	qsort(entries, count, sizeof(*entries),
+	      ports ? comparePorts : compareModels);
+
+	fprintf(output, "  %-16s Sessions  Median MB/s  Last MB/s  Retries%s\n",
+	        ports ? "Port" : "Model", ports ? "  Slow" : "");
+
+	for (size_t start = 0, end = 0; start < count; start = end)
+	{
+		char *key = ports ? entries[start].record.port
+		                  : entries[start].record.model;
+		double baseline = 0;
+		uint64_t retries = 0;
+		unsigned flagged = 0;
+
+		for (end = start; end < count; end++)
+		{
+			char *other = ports ? entries[end].record.port
+			                    : entries[end].record.model;
+
+			if (strcmp(key, other) != 0)
+			{
+				break;
+			}
+
+			retries += entries[end].record.retries;
+		}
+
+		baseline = findMedian(entries + start, end - start);
+
+		for (size_t index = start; ports && index < end; index++)
+		{
+			if (end - start >= TELEMETRY_BASELINE_MINIMUM
+			 && entries[index].record.total > 0
+			 && entries[index].record.total < baseline * TELEMETRY_SLOW_RATIO)
+			{
+				entries[index].slow = true;
+				flagged++;
+			}
+		}
+
+		fprintf(output, "  %-16s %8zu  %11.3f  %9.3f  %7llu",
+		        key, end - start, baseline, entries[end - 1].record.total,
+		        (unsigned long long)retries);
+
+		if (ports)
+		{
+			fprintf(output, "  %4u", flagged);
+		}
+
+		fprintf(output, "\n");
+		slow += flagged;
+	}
+
+	fprintf(output, "\n");
+	return slow;
+}
+
+static double findMedian(struct Entry *entries, size_t count)
+{
+	double *rates = malloc(count * sizeof(double));
+	double median = 0;
+	size_t length = 0;
+
+	if (rates == NULL)
+	{
+		return 0;
+	}
+
+	for (size_t index = 0; index < count; index++)
+	{
+		if (entries[index].record.total > 0)
+		{
+			rates[length++] = entries[index].record.total;
+		}
+	}
+
+	if (length > 0)
+	{
+		qsort(rates, length, sizeof(double), compareRates);
+		median = length % 2 ? rates[length / 2]
+		                    : (rates[length / 2 - 1] + rates[length / 2]) / 2;
+	}
+
+	free(rates);
+	return median;
+}
+
+static int comparePorts(const void *left, const void *right)
+{
+	const struct TelemetryRecord *first = left;
+	const struct TelemetryRecord *second = right;
+	int result = strcmp(first->port, second->port);
+
+	if (result == 0)
+	{
+		result = (first->time > second->time) - (first->time < second->time);
+	}
+
+	return result;
+}
+
+static int compareModels(const void *left, const void *right)
+{
+	const struct TelemetryRecord *first = left;
+	const struct TelemetryRecord *second = right;
+	int result = strcmp(first->model, second->model);
+
+	if (result == 0)
+	{
+		result = (first->time > second->time) - (first->time < second->time);
+	}
+
+	return result;
+}
+
+static int compareRates(const void *left, const void *right)
+{
+	double first = *(const double *)left;
+	double second = *(const double *)right;
+
+	return (first > second) - (first < second);
+}
+
+static int compareSamples(const void *left, const void *right)
+{
+	uint32_t first = *(const uint32_t *)left;
+	uint32_t second = *(const uint32_t *)right;
+
+	return (first > second) - (first < second);
+}
@@ -0,0 +1,63 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define TELEMETRY_SAMPLE_COUNT 1024
+#define TELEMETRY_PHASE_COUNT 3
+#define TELEMETRY_MODEL_SIZE 64
+#define TELEMETRY_PORT_SIZE 32
+#define TELEMETRY_BASELINE_MINIMUM 3
+#define TELEMETRY_SLOW_RATIO 0.5
+
+enum TelemetryPhase
+{
+	BootROMPhase,
+	FDLPhase,
+	DumpPhase
+};
+
+struct Telemetry
+{
+	double opened;
+	uint64_t bytes[TELEMETRY_PHASE_COUNT];
+	double seconds[TELEMETRY_PHASE_COUNT];
+	uint32_t frames;
+	uint32_t retries;
+
+	uint32_t samples[TELEMETRY_SAMPLE_COUNT];
+	uint32_t sampleCount;
+	unsigned seed;
+};
+
+struct TelemetryRecord
+{
+	time_t time;
+	uint16_t vendor;
+	uint16_t product;
+	uint32_t flashID;
+	char model[TELEMETRY_MODEL_SIZE];
+	char port[TELEMETRY_PORT_SIZE];
+
+	uint64_t bytes;
+	uint32_t frames;
+	uint32_t retries;
+	uint32_t roundTrip[3];
+	double total;
+	double rate[TELEMETRY_PHASE_COUNT];
+	double duration;
+};
+
+void resetTelemetry(struct Telemetry *telemetry, double now);
+void recordRoundTrip(struct Telemetry *telemetry, double seconds);
+void recordPhase(struct Telemetry *telemetry, enum TelemetryPhase phase,
+                 uint64_t bytes, double seconds);
+void summariseTelemetry(struct Telemetry *telemetry, double now,
+                        struct TelemetryRecord *record);
+
+int appendTelemetry(struct TelemetryRecord *record);
+int reportTelemetry(FILE *stream);
+
+#endif
@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# Runs every plan in this directory against the simulator. A plan passes when
+# usx exits cleanly, every "# expect: TEXT" line appears in its output and the
+# two files named by every "# same: A B" line are identical.
+
+tests=$(cd "$(dirname "$0")" && pwd)
+usx=$(dirname "$tests")/usx
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+
+cat "$(dirname "$tests")"/fdl/*.bin > "$scratch/image.bin"
+gzip -c "$scratch/image.bin" > "$scratch/image.bin.gz"
+USX_CAPABILITIES="$scratch/capabilities"
+USX_TELEMETRY="$scratch/telemetry"
+export USX_CAPABILITIES USX_TELEMETRY
+
+failed=0
+for plan in "$tests"/*.plan
+do
+	name=$(basename "$plan" .plan)
+	log="$scratch/$name.log"
+	result=ok
+	if ! (cd "$scratch" && "$usx" "$plan") > "$log" 2>&1
+	then
+		result="usx failed"
+	fi
+	while read -r text
+	do
+		if [ "$result" = ok ] && ! grep -qF -- "$text" "$log"
+		then
+			result="missing \"$text\""
+		fi
+	done <<-LIST
+		$(sed -n 's/^# expect: //p' "$plan")
+	LIST
+	while read -r first second
+	do
+		if [ "$result" = ok ] && [ -n "$first" ] && ! cmp -s "$scratch/$first" "$scratch/$second"
+		then
+			result="$first differs from $second"
+		fi
+	done <<-LIST
+		$(sed -n 's/^# same: //p' "$plan")
+	LIST
+	echo "  $name  $result"
+	if [ "$result" != ok ]
+	then
+		cat "$log"
+		failed=1
+	fi
+done
+exit $failed
@@ -0,0 +1,389 @@
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define TRACE_OUTPUT_SIZE 65536
+#define TRACE_IDLE_PERIOD 1000000
+
+enum TraceFlags
+{
+	TraceFirst = 1,
+	TraceLast  = 2
+};
+
+struct TraceRecord
+{
+	atomic_size_t sequence;
+	uint8_t  kind;
+	uint8_t  flags;
+	uint16_t length;
+	uint32_t offset;
+	uint8_t  data[TRACE_RECORD_SIZE];
+};
+
+static struct TraceRecord Records[TRACE_RECORD_COUNT];
+static atomic_size_t Head;
+static atomic_size_t Consumed;
+static atomic_uint_fast64_t Dropped;
+static atomic_bool Running;
+
+static size_t Tail = 0;
+static uint64_t Reported = 0;
+static pthread_t Thread;
+static FILE *Stream = NULL;
+
+static char Output[TRACE_OUTPUT_SIZE];
+static size_t OutputLength = 0;
+
+static char Hex[256][2];
+static char Printable[256];
+
+static void *consumeTrace(void *);
+static bool publishRecord(uint8_t, uint8_t, uint32_t, uint8_t *, size_t);
+static void formatRecord(struct TraceRecord *);
+static void formatData(struct TraceRecord *);
+static void formatFrame(struct TraceRecord *);
+static void formatDropped(void);
+static void writeOutput(void);
+static void idle(void);
+
+int startTracing(FILE *stream)
+{
+	int result = 0;
+
+	if (atomic_load(&Running))
+	{
+		return 0;
+	}
+
+	for (int byte = 0; byte < 256; byte++)
+	{
+		Hex[byte][0] = "0123456789abcdef"[byte >> 4];
+		Hex[byte][1] = "0123456789abcdef"[byte & 15];
+		Printable[byte] = isprint(byte) ? byte : '.';
+	}
+
+	for (size_t index = 0; index < TRACE_RECORD_COUNT; index++)
+	{
+		atomic_init(&Records[index].sequence, index);
+	}
+
+	atomic_init(&Head, 0);
+	atomic_init(&Consumed, 0);
+	atomic_init(&Dropped, 0);
+
+	Tail = 0;
+	Reported = 0;
+	OutputLength = 0;
+	Stream = stream;
+
+	atomic_store(&Running, true);
+	result = pthread_create(&Thread, NULL, consumeTrace, NULL);
+
+	if (result != 0)
+	{
+		atomic_store(&Running, false);
+		ERROR(strerror(result));
+		return -1;
+	}
+
+	return 0;
+}
+
+void stopTracing(void)
+{
+	if (atomic_exchange(&Running, false))
+	{
+		pthread_join(Thread, NULL);
+	}
+}
+
+void flushTrace(void)
+{
+	size_t target = atomic_load(&Head);
+
+	while (atomic_load(&Running) && atomic_load(&Consumed) < target)
+	{
+		idle();
+	}
+}
+
+void traceData(enum TraceKind kind, uint8_t *data, size_t length)
+{
+	size_t offset = 0;
+
+	do
+	{
+		uint8_t flags = 0;
+		size_t chunk = length - offset;
+
+		if (chunk > TRACE_RECORD_SIZE)
+		{
+			chunk = TRACE_RECORD_SIZE;
+		}
+
+		if (offset == 0)
+		{
+			flags |= TraceFirst;
+		}
+
+		if (offset + chunk == length)
+		{
+			flags |= TraceLast;
+		}
+
+		publishRecord(kind, flags, offset, data + offset, chunk);
+		offset += chunk;
+	}
+	while (offset < length);
+}
+
+void traceFrame(struct Frame *frame)
+{
+	uint16_t fields[] = { frame->type, frame->dataSize, frame->checksum };
+
+	publishRecord(TraceFrame, TraceFirst | TraceLast, 0,
+	              (uint8_t *)fields, sizeof(fields));
+}
+
+uint64_t countDroppedTraceRecords(void)
+{
+	return atomic_load(&Dropped);
+}
+
+static bool publishRecord(uint8_t kind, uint8_t flags, uint32_t offset,
+                          uint8_t *data, size_t length)
+{
+	struct TraceRecord *record = NULL;
+	size_t position = 0;
+
+	if (!atomic_load_explicit(&Running, memory_order_relaxed))
+	{
+		return false;
+	}
+
+	position = atomic_load_explicit(&Head, memory_order_relaxed);
+
+	for (;;)
+	{
+		size_t sequence = 0;
+
+		record = &Records[position % TRACE_RECORD_COUNT];
+		sequence = atomic_load_explicit(&record->sequence,
+		                                memory_order_acquire);
+
+		if (sequence == position)
+		{
+			if (atomic_compare_exchange_weak_explicit(&Head,
+			                                          &position,
+			                                          position + 1,
+			                                          memory_order_relaxed,
+			                                          memory_order_relaxed))
+			{
+				break;
+			}
+		}
+
+		else if ((intptr_t)(sequence - position) < 0)
+		{
+			atomic_fetch_add_explicit(&Dropped, 1, memory_order_relaxed);
+			return false;
+		}
+
+		else
+		{
+			position = atomic_load_explicit(&Head, memory_order_relaxed);
+		}
+	}
+
+	record->kind = kind;
+	record->flags = flags;
+	record->offset = offset;
+	record->length = length;
+	memcpy(record->data, data, length);
+
+	atomic_store_explicit(&record->sequence, position + 1,
+	                      memory_order_release);
+	return true;
+}
+
+static void *consumeTrace(void *argument)
+{
+	for (;;)
+	{
+		struct TraceRecord *record = &Records[Tail % TRACE_RECORD_COUNT];
+		size_t sequence = atomic_load_explicit(&record->sequence,
+		                                       memory_order_acquire);
+
+		if (sequence == Tail + 1)
+		{
+			formatRecord(record);
+			atomic_store_explicit(&record->sequence,
+			                      Tail + TRACE_RECORD_COUNT,
+			                      memory_order_release);
+			Tail++;
+
+			if (OutputLength > TRACE_OUTPUT_SIZE / 2)
+			{
+				writeOutput();
+			}
+
+			continue;
+		}
+
+		formatDropped();
+		writeOutput();
+
+		if (!atomic_load(&Running))
+		{
+			break;
+		}
+
+		idle();
+	}
+
+	return NULL;
+}
+
+static void formatRecord(struct TraceRecord *record)
+{
+	switch (record->kind)
+	{
+		case TraceTransmit:
+		case TraceReceive:
+			formatData(record);
+			break;
+
+		case TraceFrame:
+			formatFrame(record);
+			break;
+	}
+}
+
+static void formatData(struct TraceRecord *record)
+{
+	char *cursor = Output + OutputLength;
+
+	if (record->flags & TraceFirst)
+	{
+		*cursor++ = record->kind == TraceTransmit ? 'T' : 'R';
+		*cursor++ = 'X';
+		*cursor++ = '\n';
+	}
+
+	for (size_t line = 0; line < record->length; line += 16)
+	{
+		uint32_t offset = record->offset + line;
+		size_t remaining = record->length - line;
+
+		if (remaining > 16)
+		{
+			remaining = 16;
+		}
+
+		*cursor++ = ' ';
+		*cursor++ = ' ';
+
+		for (int shift = 24; shift >= 0; shift -= 8)
+		{
+			memcpy(cursor, Hex[(offset >> shift) & 0xff], 2);
+			cursor += 2;
+		}
+
+		*cursor++ = ':';
+		*cursor++ = ' ';
+
+		for (size_t index = 0; index < 16; index++)
+		{
+			if (index < remaining)
+			{
+				memcpy(cursor, Hex[record->data[line + index]], 2);
+			}
+
+			else
+			{
+				memcpy(cursor, "  ", 2);
+			}
+
+			cursor += 2;
+
+			if (index % 2)
+			{
+				*cursor++ = ' ';
+			}
+		}
+
+		*cursor++ = ' ';
+
+		for (size_t index = 0; index < remaining; index++)
+		{
+			*cursor++ = Printable[record->data[line + index]];
+		}
+
+		*cursor++ = '\n';
+	}
+
+	if (record->flags & TraceLast)
+	{
+		*cursor++ = '\n';
+	}
+
+	OutputLength = cursor - Output;
+}
+
+static void formatFrame(struct TraceRecord *record)
+{
+	uint16_t fields[3];
+
+	memcpy(fields, record->data, sizeof(fields));
+
+	OutputLength += snprintf(Output + OutputLength,
+	                         TRACE_OUTPUT_SIZE - OutputLength,
+	                         "  Frame Type:    %04x (%s)\n"
+	                         "  Data Size:     %04x\n"
+	                         "  Checksum:      %04x\n\n",
+	                         fields[0], labelFrameType(fields[0]),
+	                         fields[1], fields[2]);
+}
+
+static void formatDropped(void)
+{
+	uint64_t dropped = atomic_load(&Dropped);
+
+	if (dropped != Reported)
+	{
+		OutputLength += snprintf(Output + OutputLength,
+		                         TRACE_OUTPUT_SIZE - OutputLength,
+		                         "  %llu trace records dropped\n\n",
+		                         (unsigned long long)(dropped - Reported));
+		Reported = dropped;
+	}
+}
+
+static void writeOutput(void)
+{
+	if (OutputLength > 0)
+	{
+		fwrite(Output, 1, OutputLength, Stream);
+		fflush(Stream);
+		OutputLength = 0;
+	}
+
+	atomic_store(&Consumed, Tail);
+}
+
+static void idle(void)
+{
+	struct timespec period = { .tv_nsec = TRACE_IDLE_PERIOD };
+
+	while (nanosleep(&period, &period) == -1 && errno == EINTR)
+	{
+	}
+}
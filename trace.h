@@ -0,0 +1,29 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "frame.h"
+
+#define TRACE_RECORD_COUNT 1024
+#define TRACE_RECORD_SIZE  1024
+
+enum TraceKind
+{
+	TraceTransmit,
+	TraceReceive,
+	TraceFrame
+};
+
+int startTracing(FILE *stream);
+void stopTracing(void);
+void flushTrace(void);
+
+void traceData(enum TraceKind kind, uint8_t *data, size_t length);
+void traceFrame(struct Frame *frame);
+
+uint64_t countDroppedTraceRecords(void);
+
+#endif
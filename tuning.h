@@ -0,0 +1,9 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#define TUNING_PROBE_BYTES 65536
+#define TUNING_MINIMUM_FRAMES 4
+#define TUNING_MINIMUM_BLOCK_SIZE 512
+#define TUNING_RESOLUTION 256
+
+#endif
@@ -0,0 +1,2651 @@
+#include <netinet/in.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "broadcast.h"
+#include "capability.h"
+#include "digest.h"
+#include "hotplug.h"
+#include "image.h"
+#include "pipeline.h"
+#include "probes.h"
+#include "serial.h"
+#include "simulator.h"
+#include "system.h"
+#include "trace.h"
+#include "tuning.h"
+#include "usx.h"
+
+PROBE_SEMAPHORE(state);
+PROBE_SEMAPHORE(acknowledgement);
+PROBE_SEMAPHORE(bulk_start);
+PROBE_SEMAPHORE(bulk_done);
+PROBE_SEMAPHORE(frame_retry);
+PROBE_SEMAPHORE(bulk_retry);
+
+struct Receiver
+{
+	struct Delivery *delivery;
+	struct Broadcast *broadcast;
+	unsigned consumer;
+	char *filename;
+	uint32_t address;
+	uint32_t size;
+	uint16_t payloadSize;
+	pthread_t thread;
+	bool started;
+};
+
+static void recallCapabilities(struct Session *, struct Frame *);
+static int sendImage(struct Session *, struct Image *, uint32_t);
+static int beginTransfer(struct Session *, uint32_t, uint32_t, struct Frame *,
+                         struct Frame **);
+static int sendFrame(struct Session *, struct Frame *, uint8_t *, size_t,
+                     struct Frame *, double *);
+static void *receiveBroadcast(void *);
+static int receiveImage(struct Receiver *);
+static int catchUp(struct Receiver *, uint32_t *, struct Frame *, double *);
+static int eraseRegions(struct Session *, struct Range *, size_t, bool);
+static int verifyImage(struct Session *, struct Image *, uint32_t);
+static int compareBlock(struct Session *, uint8_t *, uint32_t, uint32_t,
+                        bool *);
+static int rewriteBlock(struct Session *, uint8_t *, uint32_t, uint32_t);
+static int prepareRegion(struct Region *, struct Segment *, struct Region *);
+static int sendTransfer(struct Session *, struct Region *, struct Segment *,
+                        size_t, unsigned);
+static int compareRegions(const void *, const void *);
+static int dumpRegion(struct Session *, FILE *, struct Digest *,
+                      uint32_t, uint32_t);
+static int prepareRealTime(struct Session *);
+static void finishRealTime(struct Session *);
+static void releaseResponse(struct Frame *, struct Frame *);
+static int claimLink(struct Session *, double *);
+static void surrenderLink(struct Session *, double, enum TelemetryPhase,
+                          uint32_t, double);
+static void recordSession(struct Session *);
+static int sendStage(struct Session *, const struct BootStage *);
+static int recallGeometry(struct Session *);
+static uint16_t alignBlockSize(struct Geometry *, uint16_t);
+static int readFlashGeometry(struct Session *, uint16_t, uint32_t *, size_t);
+static int probeBlockSize(struct Session *, uint32_t, struct Probe *);
+static int startDataTransfer(struct Session *, uint32_t, uint32_t);
+static int endDataTransfer(struct Session *);
+static int eraseFlash(struct Session *, uint32_t, uint32_t, uint32_t);
+static int readFlash(struct Session *, uint32_t, uint32_t, uint32_t,
+                     struct Frame **);
+
+static int exchange(struct Session *, struct Frame *, struct Frame **);
+static int exchangeEncoded(struct Session *, struct Frame *,
+                           uint8_t *, size_t, struct Frame **,
+                           struct Frame *);
+static int awaitResponse(struct Session *, struct Frame *, struct Frame **,
+                         struct Frame *);
+static int acknowledged(struct Session *, struct Frame *);
+static int expectAcknowledgement(struct Frame *);
+static int receiveResponse(struct Session *, struct Frame **, struct Frame *);
+static int transmit(struct Session *, uint8_t *, size_t);
+static int receive(struct Session *, uint8_t *, size_t, int *);
+
+static uint8_t *reserveBuffer(struct Session *, struct Buffer *, size_t);
+static void releaseBuffer(struct Session *, struct Buffer *);
+static uint8_t *allocatePipelineBuffer(void *, size_t);
+static void releasePipelineBuffer(void *, uint8_t *, size_t);
+
+static int openUSB(struct Session *);
+static void discoverTopology(struct Session *);
+static void closeUSB(struct Session *);
+static int transmitToUSB(struct Session *, uint8_t *, size_t);
+static int receiveFromUSB(struct Session *, uint8_t *, size_t, int *);
+static int transferUSB(struct Session *, struct libusb_transfer **,
+                       unsigned char, uint8_t *, int, int *);
+static void LIBUSB_CALL completeTransfer(struct libusb_transfer *);
+static uint8_t *allocateUSBBuffer(struct Session *, size_t, bool *);
+static void releaseUSBBuffer(struct Session *, uint8_t *, size_t, bool);
+
+
+const struct Transport USBTransport =
+{
+	.open     = openUSB,
+	.close    = closeUSB,
+	.transmit = transmitToUSB,
+	.receive  = receiveFromUSB,
+	.allocate = allocateUSBBuffer,
+	.release  = releaseUSBBuffer
+};
+
+int usxInitialise(void)
+{
+	int result = libusb_init(NULL);
+
+	if (result < 0)
+	{
+		fprintf(stderr, "%s\n\n", libusb_strerror(result));
+		return -1;
+	}
+
+	if (startTracing(stdout) == -1)
+	{
+		libusb_exit(NULL);
+		return -1;
+	}
+
+	startHotplug();
+	return 0;
+}
+
+void usxCleanup(void)
+{
+	stopHotplug();
+	stopTracing();
+	libusb_exit(NULL);
+}
+
+struct Session *usxCreateSession(void)
+{
+	struct Session *session = calloc(1, sizeof(struct Session));
+	long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (session == NULL)
+	{
+		ERROR(strerror(errno));
+		return NULL;
+	}
+
+	session->transport = &USBTransport;
+	session->timeout = SESSION_DEFAULT_TIMEOUT;
+	session->blockSize = 1024;
+	session->framing = BootROMFraming;
+	session->verbose = true;
+	session->workers = processors > 1 ? processors - 1 : 1;
+
+	pthread_mutex_init(&session->lock, NULL);
+	atomic_init(&session->cancelled, false);
+
+	return session;
+}
+
+void usxDestroySession(struct Session *session)
+{
+	if (session)
+	{
+		if (session->link != NULL)
+		{
+			usxClose(session);
+		}
+
+		destroySimulator(session->simulator);
+		destroySerial(session->serial);
+		pthread_mutex_destroy(&session->lock);
+		free(session);
+	}
+}
+
+int usxOpen(struct Session *session)
+{
+	if (session->link != NULL)
+	{
+		fprintf(stderr, "Device already open\n\n");
+		return -1;
+	}
+
+	session->zeroCopy = false;
+	session->latency = 0;
+	session->throughput = 0;
+	memset(&session->topology, 0, sizeof(session->topology));
+	memset(&session->geometry, 0, sizeof(session->geometry));
+	resetEraseMap(&session->erased);
+	memset(&session->capabilities, 0, sizeof(session->capabilities));
+	session->geometryQueried = false;
+	resetTelemetry(&session->telemetry, measureTime());
+
+	if (session->transport->open(session) == -1)
+	{
+		return -1;
+	}
+
+	PROBE3(state, session, ProbeOpened, session->framing);
+	return 0;
+}
+
+int usxClose(struct Session *session)
+{
+	if (session->link == NULL)
+	{
+		fprintf(stderr, "Device not open\n\n");
+		return -1;
+	}
+
+	if (session->capabilities.known
+	 && session->latency > session->capabilities.latency)
+	{
+		session->capabilities.latency = session->latency;
+		storeCapabilities(&session->capabilities);
+	}
+
+	releaseBuffer(session, &session->transmitBuffer);
+	releaseBuffer(session, &session->receiveBuffer);
+
+	recordSession(session);
+	session->transport->close(session);
+	PROBE3(state, session, ProbeClosed, session->framing);
+	return 0;
+}
+
+int usxSimulate(struct Session *session, uint16_t maximumPayload,
+                struct Topology *topology)
+{
+	struct Simulator *simulator = NULL;
+
+	if (session->link != NULL)
+	{
+		fprintf(stderr, "Device already open\n\n");
+		return -1;
+	}
+
+	simulator = createSimulator(maximumPayload, topology);
+
+	if (simulator == NULL)
+	{
+		return -1;
+	}
+
+	destroySimulator(session->simulator);
+	session->simulator = simulator;
+	session->transport = &SimulatedTransport;
+	return 0;
+}
+
+int usxSerial(struct Session *session, char *path, uint32_t baud)
+{
+	struct Serial *serial = NULL;
+
+	if (session->link != NULL)
+	{
+		fprintf(stderr, "Device already open\n\n");
+		return -1;
+	}
+
+	serial = createSerial(path, baud);
+
+	if (serial == NULL)
+	{
+		return -1;
+	}
+
+	destroySerial(session->serial);
+	session->serial = serial;
+	session->transport = &SerialTransport;
+	return 0;
+}
+
+int usxAwait(struct Session *session, uint32_t timeout,
+             struct Frame **banner, double *elapsed)
+{
+	struct Arrival arrival;
+	int result = 0;
+
+	if (session->link != NULL)
+	{
+		fprintf(stderr, "Device already open\n\n");
+		return -1;
+	}
+
+	if (awaitArrival(session->vendor, session->product, timeout,
+	                 &session->cancelled, &arrival) == -1)
+	{
+		return -1;
+	}
+
+	if (arrival.simulator)
+	{
+		destroySimulator(session->simulator);
+		session->simulator = arrival.simulator;
+		session->transport = &SimulatedTransport;
+	}
+
+	else
+	{
+		session->transport = &USBTransport;
+		session->device = arrival.device;
+	}
+
+	result = usxOpen(session);
+	session->device = NULL;
+
+	if (arrival.device)
+	{
+		if (result == -1)
+		{
+			dropDevice(arrival.device);
+		}
+
+		libusb_unref_device(arrival.device);
+	}
+
+	if (result == -1)
+	{
+		return -1;
+	}
+
+	if (usxGreet(session, banner) == -1)
+	{
+		usxClose(session);
+		return -1;
+	}
+
+	*elapsed = measureTime() - arrival.time;
+	return 0;
+}
+
+int usxArrive(struct Session *session, uint32_t delay,
+              uint16_t maximumPayload, struct Topology *topology)
+{
+	struct Arrival arrival =
+	{
+		.vendor  = session->vendor,
+		.product = session->product
+	};
+
+	arrival.simulator = createSimulator(maximumPayload, topology);
+
+	if (arrival.simulator == NULL)
+	{
+		return -1;
+	}
+
+	if (scheduleArrival(&arrival, delay) == -1)
+	{
+		destroySimulator(arrival.simulator);
+		return -1;
+	}
+
+	return 0;
+}
+
+int usxGreet(struct Session *session, struct Frame **banner)
+{
+	uint8_t request[] = { FRAME_DELIMITER };
+	struct Frame *response = NULL;
+
+	if (transmit(session, request, sizeof(request)) == -1)
+	{
+		return -1;
+	}
+
+	if (receiveResponse(session, &response, NULL) == -1)
+	{
+		return -1;
+	}
+
+	if (response->type != Banner)
+	{
+		if (session->verbose)
+		{
+			traceFrame(response);
+		}
+
+		deallocateFrame(response);
+		return -1;
+	}
+
+	recallCapabilities(session, response);
+	PROBE3(state, session, ProbeGreeted, session->framing);
+
+	if (banner)
+	{
+		*banner = response;
+	}
+
+	else
+	{
+		deallocateFrame(response);
+	}
+
+	return 0;
+}
+
+int usxConnect(struct Session *session)
+{
+	struct Frame request = { .type = Connect };
+	uint16_t blockSize = 0;
+
+	if (session->link == NULL)
+	{
+		fprintf(stderr, "Device not open\n\n");
+		return -1;
+	}
+
+	if (acknowledged(session, &request) == -1)
+	{
+		return -1;
+	}
+
+	session->geometryQueried = false;
+	blockSize = session->capabilities.blockSize[session->framing];
+
+	if (blockSize > 0)
+	{
+		session->blockSize = blockSize;
+	}
+
+	PROBE3(state, session, ProbeConnected, session->framing);
+	return 0;
+}
+
+int usxQueryGeometry(struct Session *session)
+{
+	struct Capabilities *capabilities = &session->capabilities;
+	uint32_t type[1];
+	uint32_t info[3];
+
+	memset(&session->geometry, 0, sizeof(session->geometry));
+
+	if (session->link == NULL)
+	{
+		fprintf(stderr, "Device not open\n\n");
+		return -1;
+	}
+
+	if (readFlashGeometry(session, ReadFlashType, type, 1) == -1)
+	{
+		return -1;
+	}
+
+	if (capabilities->geometry.flashID != type[0])
+	{
+		struct Capabilities previous = *capabilities;
+
+		capabilities->geometry.flashID = type[0];
+
+		if (loadCapabilities(capabilities) == -1)
+		{
+			*capabilities = previous;
+			memset(&capabilities->geometry, 0, sizeof(struct Geometry));
+			capabilities->blockSize[FDLFraming] = 0;
+		}
+	}
+
+	if (capabilities->geometry.pageSize > 0
+	 && capabilities->geometry.flashID == type[0])
+	{
+		session->geometry = capabilities->geometry;
+		return 0;
+	}
+
+	if (readFlashGeometry(session, ReadFlashInfo, info, 3) == -1)
+	{
+		return -1;
+	}
+
+	session->geometry.flashID = type[0];
+	session->geometry.pageSize = info[0];
+	session->geometry.sectorSize = info[1];
+	session->geometry.flashSize = info[2];
+
+	capabilities->geometry = session->geometry;
+	return storeCapabilities(capabilities);
+}
+
+int usxReset(struct Session *session)
+{
+	struct Frame request = { .type = Reset };
+
+	if (session->link == NULL)
+	{
+		fprintf(stderr, "Device not open\n\n");
+		return -1;
+	}
+
+	return acknowledged(session, &request);
+}
+
+int usxBroadcast(struct Delivery *deliveries, size_t count,
+                 char *filename, uint32_t address)
+{
+	struct Receiver receivers[BROADCAST_CONSUMER_COUNT];
+	struct Broadcast *broadcast = NULL;
+	struct Image *image = NULL;
+	uint16_t payloadSize = 0;
+	uint32_t grace = 0;
+	int result = 0;
+
+	if (count == 0 || count > BROADCAST_CONSUMER_COUNT)
+	{
+		fprintf(stderr, "Broadcast needs 1 to %u sessions\n\n",
+		        BROADCAST_CONSUMER_COUNT);
+		return -1;
+	}
+
+	for (size_t index = 0; index < count; index++)
+	{
+		deliveries[index].result = -1;
+		deliveries[index].evicted = false;
+		deliveries[index].shared = 0;
+		deliveries[index].elapsed = 0;
+	}
+
+	for (size_t index = 0; index < count; index++)
+	{
+		struct Session *session = deliveries[index].session;
+		uint16_t blockSize = 0;
+
+		if (session->link == NULL)
+		{
+			fprintf(stderr, "Device not open\n\n");
+			return -1;
+		}
+
+		if (session->framing == FDLFraming)
+		{
+			recallGeometry(session);
+		}
+
+		blockSize = alignBlockSize(&session->geometry, session->blockSize);
+
+		if (session->framing != deliveries[0].session->framing)
+		{
+			fprintf(stderr, "Sessions use different framing\n\n");
+			return -1;
+		}
+
+		if (payloadSize == 0 || blockSize < payloadSize)
+		{
+			payloadSize = blockSize;
+		}
+
+		if (session->timeout > grace)
+		{
+			grace = session->timeout;
+		}
+	}
+
+	image = openImage(filename);
+
+	if (image == NULL)
+	{
+		return -1;
+	}
+
+	broadcast = startBroadcast(image, deliveries[0].session->framing,
+	                           payloadSize, count, grace);
+
+	if (broadcast == NULL)
+	{
+		closeImage(image);
+		return -1;
+	}
+
+	for (size_t index = 0; index < count; index++)
+	{
+		struct Receiver *receiver = &receivers[index];
+		int error = 0;
+
+		receiver->delivery = &deliveries[index];
+		receiver->broadcast = broadcast;
+		receiver->consumer = index;
+		receiver->filename = filename;
+		receiver->address = address;
+		receiver->size = getImageSize(image);
+		receiver->payloadSize = payloadSize;
+
+		error = pthread_create(&receiver->thread, NULL, receiveBroadcast,
+		                       receiver);
+		receiver->started = error == 0;
+
+		if (error != 0)
+		{
+			ERROR(strerror(error));
+			leaveBroadcast(broadcast, index);
+		}
+	}
+
+	for (size_t index = 0; index < count; index++)
+	{
+		if (receivers[index].started)
+		{
+			pthread_join(receivers[index].thread, NULL);
+		}
+
+		if (deliveries[index].result == -1)
+		{
+			result = -1;
+		}
+	}
+
+	stopBroadcast(broadcast);
+	closeImage(image);
+	return result;
+}
+
+int usxErase(struct Session *session, uint32_t address, uint32_t size)
+{
+	struct Range region = { address, size };
+
+	if (session->link == NULL)
+	{
+		fprintf(stderr, "Device not open\n\n");
+		return -1;
+	}
+
+	if (session->framing != FDLFraming)
+	{
+		fprintf(stderr, "Erase requires fdl framing\n\n");
+		return -1;
+	}
+
+	session->erasures = 0;
+	session->erasedBytes = 0;
+	return eraseRegions(session, &region, 1, false);
+}
+
+int usxExecute(struct Session *session)
+{
+	struct Frame request = { .type = ExecuteData };
+
+	if (acknowledged(session, &request) == -1)
+	{
+		return -1;
+	}
+
+	session->framing = FDLFraming;
+	return 0;
+}
+
+int usxBoot(struct Session *session,
+            const struct BootStage *stages, size_t count)
+{
+	struct Frame request = { .type = Connect };
+
+	if (session->link == NULL)
+	{
+		fprintf(stderr, "Device not open\n\n");
+		return -1;
+	}
+
+	if (usxGreet(session, NULL) == -1)
+	{
+		return -1;
+	}
+
+	for (size_t index = 0; index < count; index++)
+	{
+		session->framing = stages[index].framing;
+
+		if (acknowledged(session, &request) == -1)
+		{
+			return -1;
+		}
+
+		session->geometryQueried = false;
+
+		if (sendStage(session, &stages[index]) == -1)
+		{
+			fprintf(stderr, "%s rejected\n\n", stages[index].name);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void usxCancel(struct Session *session)
+{
+	atomic_store(&session->cancelled, true);
+
+	pthread_mutex_lock(&session->lock);
+
+	if (session->activeTransfer)
+	{
+		libusb_cancel_transfer(session->activeTransfer);
+	}
+
+	pthread_mutex_unlock(&session->lock);
+
+	if (session->scheduler)
+	{
+		wakeScheduler(session->scheduler);
+	}
+
+	wakeArrivals();
+}
+
+int usxSend(struct Session *session, char *filename, uint32_t address)
+{
+	struct Image *image = NULL;
+	int result = 0;
+
+	image = openImage(filename);
+
+	if (image == NULL)
+	{
+		return -1;
+	}
+
+	result = usxSendImage(session, image, address);
+	closeImage(image);
+	return result;
+}
+
+int usxSendImage(struct Session *session, struct Image *image,
+                 uint32_t address)
+{
+	enum TelemetryPhase phase = session->framing == FDLFraming ? FDLPhase
+	                                                           : BootROMPhase;
+	int result = 0;
+	double demand = 0;
+	double start = 0;
+
+	session->erasures = 0;
+	session->erasedBytes = 0;
+	session->verifiedBytes = 0;
+	session->rewrites = 0;
+
+	if (claimLink(session, &demand) == -1)
+	{
+		return -1;
+	}
+
+	start = measureTime();
+	result = sendImage(session, image, address);
+	surrenderLink(session, demand, phase,
+	              result == 0 ? getImageSize(image) : 0,
+	              measureTime() - start);
+
+	if (result == 0 && session->verifying)
+	{
+		result = verifyImage(session, image, address);
+	}
+
+	return result;
+}
+
+struct Segment *usxOpenRegions(struct Region *regions, size_t count)
+{
+	struct Segment *segments = calloc(count, sizeof(struct Segment));
+	int result = 0;
+
+	if (segments == NULL)
+	{
+		ERROR(strerror(errno));
+		return NULL;
+	}
+
+	qsort(regions, count, sizeof(struct Region), compareRegions);
+
+	for (size_t index = 0; index < count && result == 0; index++)
+	{
+		result = prepareRegion(&regions[index], &segments[index],
+		                       index > 0 ? &regions[index - 1] : NULL);
+	}
+
+	if (result == -1)
+	{
+		usxCloseRegions(segments, count);
+		return NULL;
+	}
+
+	return segments;
+}
+
+void usxCloseRegions(struct Segment *segments, size_t count)
+{
+	for (size_t index = 0; segments && index < count; index++)
+	{
+		closeImage(segments[index].source);
+	}
+
+	free(segments);
+}
+
+int usxSendRegions(struct Session *session, struct Region *regions,
+                   struct Segment *segments, size_t count,
+                   unsigned *transfers)
+{
+	int result = 0;
+
+	*transfers = 0;
+	session->erasures = 0;
+	session->erasedBytes = 0;
+	session->verifiedBytes = 0;
+	session->rewrites = 0;
+
+	if (session->link == NULL)
+	{
+		fprintf(stderr, "Device not open\n\n");
+		return -1;
+	}
+
+	for (size_t start = 0, end = 0; start < count && result == 0; start = end)
+	{
+		uint64_t address = regions[start].address;
+
+		for (end = start; end < count && regions[end].address == address;
+		     end++)
+		{
+			address += regions[end].length;
+		}
+
+		result = sendTransfer(session, regions + start, segments + start,
+		                      end - start, (*transfers)++);
+	}
+
+	return result;
+}
+
+int usxDump(struct Session *session, char *filename,
+            uint32_t address, uint32_t size)
+{
+	char manifest[PATH_MAX];
+	struct Digest *digest = NULL;
+	FILE *stream = NULL;
+	double demand = 0;
+	double start = 0;
+	int result = 0;
+
+	stream = fopen(filename, "w");
+
+	if (stream == NULL)
+	{
+		fprintf(stderr, "%s\n\n", strerror(errno));
+		return -1;
+	}
+
+	snprintf(manifest, sizeof(manifest), "%s.manifest", filename);
+	digest = startDigest(manifest, address, size);
+
+	if (digest == NULL)
+	{
+		fclose(stream);
+		return -1;
+	}
+
+	if (claimLink(session, &demand) == -1)
+	{
+		finishDigest(digest, false);
+		fclose(stream);
+		return -1;
+	}
+
+	start = measureTime();
+	result = dumpRegion(session, stream, digest, address, size);
+	surrenderLink(session, demand, DumpPhase, result == 0 ? size : 0,
+	              measureTime() - start);
+	return result;
+}
+
+int usxTune(struct Session *session, uint32_t address, uint16_t limit,
+            struct Probe *probes, size_t *count)
+{
+	size_t capacity = *count;
+	struct Probe *best = NULL;
+	uint32_t blockSize = TUNING_MINIMUM_BLOCK_SIZE;
+	uint32_t accepted = 0;
+	uint32_t rejected = 0;
+
+	*count = 0;
+
+	if (session->link == NULL)
+	{
+		fprintf(stderr, "Device not open\n\n");
+		return -1;
+	}
+
+	if (limit < TUNING_MINIMUM_BLOCK_SIZE)
+	{
+		fprintf(stderr, "Limit below minimum block size\n\n");
+		return -1;
+	}
+
+	while (*count < capacity)
+	{
+		struct Probe *probe = &probes[(*count)++];
+
+		probe->blockSize = blockSize;
+
+		if (probeBlockSize(session, address, probe) == -1)
+		{
+			return -1;
+		}
+
+		if (probe->errors > 0)
+		{
+			rejected = probe->blockSize;
+
+			if (rejected == TUNING_MINIMUM_BLOCK_SIZE)
+			{
+				break;
+			}
+		}
+
+		else
+		{
+			accepted = probe->blockSize;
+
+			if (best == NULL || probe->throughput > best->throughput)
+			{
+				best = probe;
+			}
+		}
+
+		if (rejected == 0)
+		{
+			if (blockSize == limit)
+			{
+				break;
+			}
+
+			blockSize = blockSize * 2 < limit ? blockSize * 2 : limit;
+		}
+
+		else
+		{
+			blockSize = (accepted + rejected) / 2 & ~(TUNING_RESOLUTION - 1);
+
+			if (blockSize <= accepted)
+			{
+				break;
+			}
+		}
+	}
+
+	if (best == NULL)
+	{
+		fprintf(stderr, "No usable block size\n\n");
+		return -1;
+	}
+
+	session->blockSize = best->blockSize;
+	session->capabilities.blockSize[session->framing] = best->blockSize;
+
+	return storeCapabilities(&session->capabilities);
+}
+
+static void recallCapabilities(struct Session *session, struct Frame *banner)
+{
+	struct Capabilities *capabilities = &session->capabilities;
+	uint16_t length = banner->dataSize < CAPABILITY_BANNER_SIZE
+	                ? banner->dataSize : CAPABILITY_BANNER_SIZE;
+	uint32_t timeout = 0;
+
+	if (capabilities->known && length == capabilities->bannerLength
+	 && memcmp(banner->data, capabilities->banner, length) == 0)
+	{
+		return;
+	}
+
+	capabilities->vendor = session->vendor;
+	capabilities->product = session->product;
+	capabilities->bannerLength = length;
+	memcpy(capabilities->banner, banner->data, length);
+	memset(&session->geometry, 0, sizeof(session->geometry));
+	capabilities->geometry.flashID = 0;
+	session->timeout = SESSION_DEFAULT_TIMEOUT;
+
+	if (loadCapabilities(capabilities) == -1)
+	{
+		capabilities->known = true;
+		return;
+	}
+
+	timeout = capabilities->latency * CAPABILITY_TIMEOUT_MARGIN;
+
+	if (timeout < CAPABILITY_MINIMUM_TIMEOUT)
+	{
+		timeout = CAPABILITY_MINIMUM_TIMEOUT;
+	}
+
+	if (capabilities->latency > 0 && timeout < SESSION_DEFAULT_TIMEOUT)
+	{
+		session->timeout = timeout;
+	}
+}
+
+static int probeBlockSize(struct Session *session, uint32_t address,
+                          struct Probe *probe)
+{
+	uint8_t *data = calloc(1, probe->blockSize);
+	uint32_t frames = TUNING_PROBE_BYTES / probe->blockSize;
+	uint32_t acknowledged = 0;
+	double start = 0;
+
+	if (data == NULL)
+	{
+		ERROR(strerror(errno));
+		return -1;
+	}
+
+	if (frames < TUNING_MINIMUM_FRAMES)
+	{
+		frames = TUNING_MINIMUM_FRAMES;
+	}
+
+	probe->frames = 0;
+	probe->errors = 0;
+	probe->throughput = 0;
+	markWritten(&session->erased, address, frames * probe->blockSize);
+
+	if (startDataTransfer(session, address, frames * probe->blockSize) == -1)
+	{
+		free(data);
+		return -1;
+	}
+
+	start = measureTime();
+
+	while (probe->frames < frames)
+	{
+		struct Frame request =
+		{
+			.type     = DataTransfer,
+			.dataSize = probe->blockSize,
+			.data     = data
+		};
+
+		struct Frame *response = NULL;
+
+		probe->frames++;
+
+		if (exchange(session, &request, &response) == -1)
+		{
+			probe->errors++;
+			break;
+		}
+
+		if (expectAcknowledgement(response) == -1)
+		{
+			probe->errors++;
+			break;
+		}
+
+		acknowledged++;
+	}
+
+	probe->throughput = acknowledged * (double)probe->blockSize
+	                  / (measureTime() - start);
+
+	free(data);
+
+	if (endDataTransfer(session) == -1 && probe->errors == 0)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+static int sendImage(struct Session *session, struct Image *image,
+                     uint32_t address)
+{
+	struct Pipeline *pipeline = NULL;
+	uint32_t size = getImageSize(image);
+	uint32_t remaining = size;
+	uint16_t blockSize = 0;
+	uint32_t leading = 0;
+	uint16_t packetSize = session->packing ? session->packetSize : 0;
+	struct Frame acknowledgement;
+	struct Frame *storage = NULL;
+	double acknowledged = 0;
+	uint8_t trailing = 0;
+
+	if (session->framing == FDLFraming)
+	{
+		recallGeometry(session);
+	}
+
+	blockSize = alignBlockSize(&session->geometry, session->blockSize);
+	leading = (blockSize - address % blockSize) % blockSize;
+
+	if (packetSize > 0)
+	{
+		blockSize = session->blockSize;
+		leading = 0;
+	}
+
+	struct Allocator allocator =
+	{
+		.allocate = allocatePipelineBuffer,
+		.release  = releasePipelineBuffer,
+		.context  = session
+	};
+
+	pipeline = startPipeline(image, session->framing, blockSize, leading,
+	                         packetSize, session->workers, &allocator);
+
+	if (pipeline == NULL)
+	{
+		return -1;
+	}
+
+	if (beginTransfer(session, address, size, &acknowledgement,
+	                  &storage) == -1)
+	{
+		stopPipeline(pipeline);
+		return -1;
+	}
+
+	while (remaining > 0)
+	{
+		struct Frame header;
+		uint8_t *buffer = NULL;
+		size_t length = 0;
+		int result = 0;
+
+		if (takeFrame(pipeline, &header, &buffer, &length) == -1)
+		{
+			finishRealTime(session);
+			stopPipeline(pipeline);
+			return -1;
+		}
+
+		result = sendFrame(session, &header, buffer, length, storage,
+		                   &acknowledged);
+		releaseFrame(pipeline);
+
+		if (result == -1)
+		{
+			finishRealTime(session);
+			stopPipeline(pipeline);
+			return -1;
+		}
+
+		remaining -= header.dataSize;
+
+		if (session->progress)
+		{
+			session->progress(session->progressContext,
+			                  size - remaining, size);
+		}
+	}
+
+	finishRealTime(session);
+	stopPipeline(pipeline);
+
+	if (readImage(image, &trailing, 1) != 0)
+	{
+		ERROR("Image does not match its recorded size");
+		return -1;
+	}
+
+	return endDataTransfer(session);
+}
+
+static int beginTransfer(struct Session *session, uint32_t address,
+                         uint32_t size, struct Frame *acknowledgement,
+                         struct Frame **storage)
+{
+	session->packets = 0;
+	session->wireBytes = 0;
+	session->realTime.locked = session->realTime.enabled;
+	resetGaps(&session->gaps);
+	*storage = NULL;
+
+	if (session->erasing && session->framing == FDLFraming)
+	{
+		struct Range region = { address, size };
+
+		if (eraseRegions(session, &region, 1, true) == -1)
+		{
+			return -1;
+		}
+	}
+
+	markWritten(&session->erased, address, size);
+
+	if (session->realTime.enabled)
+	{
+		if (prepareRealTime(session) == -1)
+		{
+			return -1;
+		}
+
+		*storage = acknowledgement;
+	}
+
+	if (startDataTransfer(session, address, size) == -1)
+	{
+		finishRealTime(session);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int sendFrame(struct Session *session, struct Frame *header,
+                     uint8_t *buffer, size_t length, struct Frame *storage,
+                     double *acknowledged)
+{
+	struct Frame *response = NULL;
+
+	if (session->packetSize > 0)
+	{
+		session->packets += (length + session->packetSize - 1)
+		                  / session->packetSize;
+		session->wireBytes += length;
+	}
+
+	if (*acknowledged > 0)
+	{
+		recordGap(&session->gaps, measureTime() - *acknowledged);
+	}
+
+	if (exchangeEncoded(session, header, buffer, length, &response,
+	                    storage) == -1)
+	{
+		return -1;
+	}
+
+	*acknowledged = measureTime();
+
+	if (response->type != Acknowledgement)
+	{
+		releaseResponse(response, storage);
+		return -1;
+	}
+
+	releaseResponse(response, storage);
+	return 0;
+}
+
+static void *receiveBroadcast(void *argument)
+{
+	struct Receiver *receiver = argument;
+	struct Session *session = receiver->delivery->session;
+	enum TelemetryPhase phase = session->framing == FDLFraming ? FDLPhase
+	                                                           : BootROMPhase;
+	struct Image *image = NULL;
+	double demand = 0;
+	double start = 0;
+	int result = 0;
+
+	session->erasures = 0;
+	session->erasedBytes = 0;
+	session->verifiedBytes = 0;
+	session->rewrites = 0;
+
+	if (claimLink(session, &demand) == -1)
+	{
+		leaveBroadcast(receiver->broadcast, receiver->consumer);
+		return NULL;
+	}
+
+	start = measureTime();
+	result = receiveImage(receiver);
+	receiver->delivery->elapsed = measureTime() - start;
+	surrenderLink(session, demand, phase, result == 0 ? receiver->size : 0,
+	              receiver->delivery->elapsed);
+
+	if (result == 0 && session->verifying)
+	{
+		image = openImage(receiver->filename);
+		result = image ? verifyImage(session, image, receiver->address) : -1;
+		closeImage(image);
+	}
+
+	receiver->delivery->result = result;
+	return NULL;
+}
+
+static int receiveImage(struct Receiver *receiver)
+{
+	struct Session *session = receiver->delivery->session;
+	struct Frame acknowledgement;
+	struct Frame *storage = NULL;
+	double acknowledged = 0;
+	uint32_t remaining = receiver->size;
+	int result = 0;
+
+	if (beginTransfer(session, receiver->address, receiver->size,
+	                  &acknowledgement, &storage) == -1)
+	{
+		leaveBroadcast(receiver->broadcast, receiver->consumer);
+		return -1;
+	}
+
+	joinBroadcast(receiver->broadcast, receiver->consumer);
+
+	while (remaining > 0)
+	{
+		struct Frame header;
+		uint8_t *buffer = NULL;
+		size_t length = 0;
+
+		if (takeBroadcastFrame(receiver->broadcast, receiver->consumer,
+		                       &header, &buffer, &length) == -1)
+		{
+			break;
+		}
+
+		result = sendFrame(session, &header, buffer, length, storage,
+		                   &acknowledged);
+		releaseBroadcastFrame(receiver->broadcast, receiver->consumer);
+
+		if (result == -1)
+		{
+			break;
+		}
+
+		remaining -= header.dataSize;
+		receiver->delivery->shared += header.dataSize;
+
+		if (session->progress)
+		{
+			session->progress(session->progressContext,
+			                  receiver->size - remaining, receiver->size);
+		}
+	}
+
+	receiver->delivery->evicted = isEvicted(receiver->broadcast,
+	                                        receiver->consumer);
+	leaveBroadcast(receiver->broadcast, receiver->consumer);
+
+	if (result == 0 && remaining > 0)
+	{
+		if (receiver->delivery->evicted)
+		{
+			result = catchUp(receiver, &remaining, storage, &acknowledged);
+		}
+
+		else
+		{
+			ERROR("Broadcast ended early");
+			result = -1;
+		}
+	}
+
+	finishRealTime(session);
+
+	if (result == -1)
+	{
+		return -1;
+	}
+
+	return endDataTransfer(session);
+}
+
+static int catchUp(struct Receiver *receiver, uint32_t *remaining,
+                   struct Frame *storage, double *acknowledged)
+{
+	struct Session *session = receiver->delivery->session;
+	struct Segment segment = { .offset = receiver->size - *remaining,
+	                           .length = *remaining };
+	struct Pipeline *pipeline = NULL;
+	struct Image *image = NULL;
+	int result = 0;
+
+	struct Allocator allocator =
+	{
+		.allocate = allocatePipelineBuffer,
+		.release  = releasePipelineBuffer,
+		.context  = session
+	};
+
+	segment.source = openImage(receiver->filename);
+
+	if (segment.source == NULL)
+	{
+		return -1;
+	}
+
+	image = joinImages(&segment, 1);
+
+	if (image)
+	{
+		pipeline = startPipeline(image, session->framing,
+		                         receiver->payloadSize, 0, 0,
+		                         session->workers, &allocator);
+	}
+
+	while (pipeline && *remaining > 0 && result == 0)
+	{
+		struct Frame header;
+		uint8_t *buffer = NULL;
+		size_t length = 0;
+
+		if (takeFrame(pipeline, &header, &buffer, &length) == -1)
+		{
+			result = -1;
+			break;
+		}
+
+		result = sendFrame(session, &header, buffer, length, storage,
+		                   acknowledged);
+		releaseFrame(pipeline);
+
+		if (result == 0)
+		{
+			*remaining -= header.dataSize;
+
+			if (session->progress)
+			{
+				session->progress(session->progressContext,
+				                  receiver->size - *remaining,
+				                  receiver->size);
+			}
+		}
+	}
+
+	if (pipeline == NULL)
+	{
+		result = -1;
+	}
+
+	stopPipeline(pipeline);
+	closeImage(image);
+	closeImage(segment.source);
+	return result;
+}
+
+static int prepareRegion(struct Region *region, struct Segment *segment,
+                         struct Region *previous)
+{
+	uint32_t size = 0;
+
+	region->sent = false;
+	region->transfer = 0;
+	region->elapsed = 0;
+	segment->source = openImage(region->filename);
+
+	if (segment->source == NULL)
+	{
+		return -1;
+	}
+
+	size = getImageSize(segment->source);
+
+	if (region->offset > size)
+	{
+		fprintf(stderr, "%s: Offset beyond end of image\n\n",
+		        region->filename);
+		return -1;
+	}
+
+	if (region->length == 0)
+	{
+		region->length = size - region->offset;
+	}
+
+	if (region->length == 0 || region->length > size - region->offset)
+	{
+		fprintf(stderr, "%s: Invalid region length\n\n", region->filename);
+		return -1;
+	}
+
+	if ((uint64_t)region->address + region->length > (uint64_t)UINT32_MAX + 1)
+	{
+		fprintf(stderr, "%s: Region exceeds address space\n\n",
+		        region->filename);
+		return -1;
+	}
+
+	if (previous
+	 && region->address < (uint64_t)previous->address + previous->length)
+	{
+		fprintf(stderr, "Regions overlap at %08x\n\n", region->address);
+		return -1;
+	}
+
+	segment->offset = region->offset;
+	segment->length = region->length;
+	return 0;
+}
+
+static int sendTransfer(struct Session *session, struct Region *regions,
+                        struct Segment *segments, size_t count,
+                        unsigned transfer)
+{
+	enum TelemetryPhase phase = session->framing == FDLFraming ? FDLPhase
+	                                                           : BootROMPhase;
+	struct Image *image = joinImages(segments, count);
+	double demand = 0;
+	double elapsed = 0;
+	int result = 0;
+
+	if (image == NULL)
+	{
+		return -1;
+	}
+
+	if (claimLink(session, &demand) == -1)
+	{
+		closeImage(image);
+		return -1;
+	}
+
+	elapsed = measureTime();
+	result = sendImage(session, image, regions[0].address);
+	elapsed = measureTime() - elapsed;
+	surrenderLink(session, demand, phase,
+	              result == 0 ? getImageSize(image) : 0, elapsed);
+
+	if (result == 0 && session->verifying)
+	{
+		result = verifyImage(session, image, regions[0].address);
+	}
+
+	for (size_t index = 0; index < count; index++)
+	{
+		regions[index].transfer = transfer;
+		regions[index].elapsed = elapsed;
+		regions[index].sent = result == 0;
+	}
+
+	closeImage(image);
+	return result;
+}
+
+static int compareRegions(const void *left, const void *right)
+{
+	const struct Region *first = left;
+	const struct Region *second = right;
+
+	return (first->address > second->address)
+	     - (first->address < second->address);
+}
+
+static int eraseRegions(struct Session *session, struct Range *regions,
+                        size_t count, bool covered)
+{
+	struct Geometry *geometry = &session->geometry;
+	struct Range *plan = NULL;
+	size_t planned = 0;
+	uint32_t unit = 0;
+
+	if (recallGeometry(session) == -1)
+	{
+		return -1;
+	}
+
+	unit = geometry->sectorSize ? geometry->sectorSize : geometry->pageSize;
+	plan = planErase(&session->erased, unit, regions, count, covered,
+	                 &planned);
+
+	if (plan == NULL)
+	{
+		return -1;
+	}
+
+	for (size_t index = 0; index < planned; index++)
+	{
+		uint32_t timeout = plan[index].size / unit * ERASE_SECTOR_TIMEOUT;
+
+		if (eraseFlash(session, plan[index].address, plan[index].size,
+		               timeout) == -1)
+		{
+			fprintf(stderr, "Erase rejected at %08x\n\n", plan[index].address);
+			free(plan);
+			return -1;
+		}
+
+		markErased(&session->erased, plan[index].address, plan[index].size);
+		session->erasures++;
+		session->erasedBytes += plan[index].size;
+	}
+
+	free(plan);
+	return 0;
+}
+
+static int verifyImage(struct Session *session, struct Image *image,
+                       uint32_t address)
+{
+	uint32_t size = getImageSize(image);
+	uint8_t *expected = malloc(session->blockSize);
+	uint32_t offset = 0;
+	double demand = 0;
+	int result = 0;
+
+	if (expected == NULL)
+	{
+		ERROR(strerror(errno));
+		return -1;
+	}
+
+	if (rewindImage(image) == -1 || claimLink(session, &demand) == -1)
+	{
+		free(expected);
+		return -1;
+	}
+
+	while (offset < size && result == 0)
+	{
+		uint32_t length = size - offset;
+		bool matched = false;
+
+		if (length > session->blockSize)
+		{
+			length = session->blockSize;
+		}
+
+		if (readImage(image, expected, length) != length)
+		{
+			ERROR("Image ended early");
+			result = -1;
+			break;
+		}
+
+		result = compareBlock(session, expected, address + offset, length,
+		                      &matched);
+
+		if (result == 0 && !matched)
+		{
+			session->rewrites++;
+			result = rewriteBlock(session, expected, address + offset, length);
+		}
+
+		if (result == 0 && !matched)
+		{
+			result = compareBlock(session, expected, address + offset, length,
+			                      &matched);
+
+			if (result == 0 && !matched)
+			{
+				fprintf(stderr, "Verification failed at %08x\n\n",
+				        address + offset);
+				result = -1;
+			}
+		}
+
+		offset += length;
+		session->verifiedBytes += result == 0 ? length : 0;
+	}
+
+	surrenderLink(session, demand, DumpPhase, 0, 0);
+	free(expected);
+	return result;
+}
+
+static int compareBlock(struct Session *session, uint8_t *expected,
+                        uint32_t address, uint32_t length, bool *matched)
+{
+	uint32_t received = 0;
+
+	*matched = true;
+
+	while (received < length)
+	{
+		struct Frame *response = NULL;
+
+		if (readFlash(session, address, received, length - received,
+		              &response) == -1)
+		{
+			return -1;
+		}
+
+		if (memcmp(response->data, expected + received, response->dataSize))
+		{
+			*matched = false;
+		}
+
+		received += response->dataSize;
+		deallocateFrame(response);
+	}
+
+	return 0;
+}
+
+static int rewriteBlock(struct Session *session, uint8_t *data,
+                        uint32_t address, uint32_t length)
+{
+	struct Frame request =
+	{
+		.type     = DataTransfer,
+		.dataSize = length,
+		.data     = data
+	};
+
+	fprintf(stderr, "Mismatch at %08x, rewriting %x bytes\n\n", address,
+	        length);
+	markWritten(&session->erased, address, length);
+
+	if (startDataTransfer(session, address, length) == -1)
+	{
+		return -1;
+	}
+
+	if (acknowledged(session, &request) == -1)
+	{
+		return -1;
+	}
+
+	return endDataTransfer(session);
+}
+
+static int dumpRegion(struct Session *session, FILE *stream,
+                      struct Digest *digest, uint32_t address, uint32_t size)
+{
+	uint32_t offset = 0;
+
+	while (offset < size)
+	{
+		struct Frame *response = NULL;
+		uint32_t length = size - offset;
+
+		if (length > session->blockSize)
+		{
+			length = session->blockSize;
+		}
+
+		if (readFlash(session, address, offset, length, &response) == -1)
+		{
+			finishDigest(digest, false);
+			fclose(stream);
+			return -1;
+		}
+
+		if (fwrite(response->data, 1, response->dataSize, stream)
+		    != response->dataSize)
+		{
+			fprintf(stderr, "%s\n\n", strerror(errno));
+			deallocateFrame(response);
+			finishDigest(digest, false);
+			fclose(stream);
+			return -1;
+		}
+
+		offset += response->dataSize;
+
+		if (feedDigest(digest, response) == -1)
+		{
+			finishDigest(digest, false);
+			fclose(stream);
+			return -1;
+		}
+
+		if (session->progress)
+		{
+			session->progress(session->progressContext, offset, size);
+		}
+	}
+
+	if (fclose(stream) == EOF)
+	{
+		fprintf(stderr, "%s\n\n", strerror(errno));
+		finishDigest(digest, false);
+		return -1;
+	}
+
+	return finishDigest(digest, true);
+}
+
+static int prepareRealTime(struct Session *session)
+{
+	size_t size = session->blockSize;
+
+	if (size < RECEIVE_MINIMUM_SIZE)
+	{
+		size = RECEIVE_MINIMUM_SIZE;
+	}
+
+	if (!session->receiveBuffer.locked)
+	{
+		releaseBuffer(session, &session->receiveBuffer);
+	}
+
+	if (reserveBuffer(session, &session->receiveBuffer,
+	                  MAXIMUM_FRAME_SIZE(size)) == NULL)
+	{
+		return -1;
+	}
+
+	enterRealTime(&session->realTime);
+	return 0;
+}
+
+static void finishRealTime(struct Session *session)
+{
+	if (session->realTime.enabled)
+	{
+		leaveRealTime(&session->realTime);
+	}
+}
+
+static void releaseResponse(struct Frame *response, struct Frame *storage)
+{
+	if (response != storage)
+	{
+		deallocateFrame(response);
+	}
+}
+
+static int claimLink(struct Session *session, double *demand)
+{
+	*demand = session->throughput > 0 ? session->throughput
+	                                  : SCHEDULER_DEFAULT_DEMAND;
+
+	if (session->scheduler == NULL)
+	{
+		return 0;
+	}
+
+	return acquireLink(session->scheduler, &session->topology, *demand,
+	                   &session->cancelled);
+}
+
+static void surrenderLink(struct Session *session, double demand,
+                          enum TelemetryPhase phase,
+                          uint32_t transferred, double elapsed)
+{
+	if (session->scheduler)
+	{
+		releaseLink(session->scheduler, &session->topology, demand);
+	}
+
+	if (transferred > 0 && elapsed > 0)
+	{
+		session->throughput = transferred / elapsed;
+		recordPhase(&session->telemetry, phase, transferred, elapsed);
+	}
+}
+
+static void recordSession(struct Session *session)
+{
+	struct TelemetryRecord record;
+	struct Capabilities *capabilities = &session->capabilities;
+
+	if (session->telemetry.frames == 0)
+	{
+		return;
+	}
+
+	summariseTelemetry(&session->telemetry, measureTime(), &record);
+	record.vendor = session->vendor;
+	record.product = session->product;
+	record.flashID = session->geometry.flashID;
+
+	for (uint16_t index = 0; index < capabilities->bannerLength
+	     && index < TELEMETRY_MODEL_SIZE - 1; index++)
+	{
+		record.model[index] = isgraph(capabilities->banner[index])
+		                    ? capabilities->banner[index] : '_';
+	}
+
+	if (session->topology.depth > 0)
+	{
+		formatTopology(&session->topology, record.port, sizeof(record.port));
+	}
+
+	appendTelemetry(&record);
+}
+
+static int sendStage(struct Session *session, const struct BootStage *stage)
+{
+	uint32_t sent = 0;
+
+	for (size_t index = 0; index < stage->frameCount; index++)
+	{
+		const struct BootFrame *frame = &stage->frames[index];
+		struct Frame *response = NULL;
+
+		struct Frame header =
+		{
+			.type     = frame->type,
+			.dataSize = frame->dataSize,
+			.checksum = frame->checksum
+		};
+
+		if (exchangeEncoded(session, &header,
+		                    (uint8_t *)stage->bytes + frame->offset,
+		                    frame->length, &response, NULL) == -1)
+		{
+			return -1;
+		}
+
+		if (expectAcknowledgement(response) == -1)
+		{
+			return -1;
+		}
+
+		if (frame->type == DataTransfer)
+		{
+			sent += frame->dataSize;
+
+			if (session->progress)
+			{
+				session->progress(session->progressContext,
+				                  sent, stage->size);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int recallGeometry(struct Session *session)
+{
+	if (session->geometry.sectorSize || session->geometry.pageSize)
+	{
+		return 0;
+	}
+
+	if (session->geometryQueried)
+	{
+		return -1;
+	}
+
+	session->geometryQueried = true;
+
+	if (usxQueryGeometry(session) == -1)
+	{
+		fprintf(stderr, "Flash geometry unavailable\n\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint16_t alignBlockSize(struct Geometry *geometry, uint16_t blockSize)
+{
+	uint32_t unit = geometry->sectorSize ? geometry->sectorSize
+	                                     : geometry->pageSize;
+	uint16_t aligned = blockSize;
+
+	if (unit == 0)
+	{
+		return blockSize;
+	}
+
+	if (aligned >= unit)
+	{
+		return aligned - aligned % unit;
+	}
+
+	while (unit % aligned)
+	{
+		aligned--;
+	}
+
+	return aligned;
+}
+
+static int readFlashGeometry(struct Session *session, uint16_t type,
+                             uint32_t *fields, size_t count)
+{
+	struct Frame request = { .type = type };
+	struct Frame *response = NULL;
+
+	if (exchange(session, &request, &response) == -1)
+	{
+		return -1;
+	}
+
+	if (response->type != ReadFlashResponse
+	 || response->dataSize < count * sizeof(uint32_t))
+	{
+		fprintf(stderr, "%s not supported\n\n", labelFrameType(type));
+		deallocateFrame(response);
+		return -1;
+	}
+
+	memcpy(fields, response->data, count * sizeof(uint32_t));
+
+	for (size_t index = 0; index < count; index++)
+	{
+		fields[index] = ntohl(fields[index]);
+	}
+
+	deallocateFrame(response);
+	return 0;
+}
+
+static int startDataTransfer(struct Session *session,
+                             uint32_t destination, uint32_t size)
+{
+	uint32_t data[] = { htonl(destination), htonl(size) };
+
+	struct Frame request =
+	{
+		.type     = StartDataTransfer,
+		.dataSize = sizeof(data),
+		.data     = (uint8_t *)data
+	};
+
+	return acknowledged(session, &request);
+}
+
+static int endDataTransfer(struct Session *session)
+{
+	struct Frame request = { .type = EndDataTransfer };
+
+	return acknowledged(session, &request);
+}
+
+static int eraseFlash(struct Session *session, uint32_t address,
+                      uint32_t size, uint32_t timeout)
+{
+	uint32_t data[] = { htonl(address), htonl(size) };
+	uint32_t saved = session->timeout;
+	int result = 0;
+
+	struct Frame request =
+	{
+		.type     = EraseFlash,
+		.dataSize = sizeof(data),
+		.data     = (uint8_t *)data
+	};
+
+	session->timeout += timeout;
+	result = acknowledged(session, &request);
+	session->timeout = saved;
+	return result;
+}
+
+static int readFlash(struct Session *session, uint32_t address,
+                     uint32_t offset, uint32_t length, struct Frame **response)
+{
+	uint32_t data[] = { htonl(address), htonl(length), htonl(offset) };
+
+	struct Frame request =
+	{
+		.type     = ReadFlash,
+		.dataSize = sizeof(data),
+		.data     = (uint8_t *)data
+	};
+
+	if (exchange(session, &request, response) == -1)
+	{
+		return -1;
+	}
+
+	if ((*response)->type != ReadFlashResponse)
+	{
+		deallocateFrame(*response);
+		return -1;
+	}
+
+	if ((*response)->dataSize == 0 || (*response)->dataSize > length)
+	{
+		ERROR("Unexpected read length");
+		deallocateFrame(*response);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int exchange(struct Session *session,
+                    struct Frame *request, struct Frame **response)
+{
+	uint8_t *buffer = reserveBuffer(session, &session->transmitBuffer,
+	                                MAXIMUM_FRAME_SIZE(request->dataSize));
+	enum Framing framing = session->framing;
+	size_t length = 0;
+
+	if (buffer == NULL)
+	{
+		return -1;
+	}
+
+	length = encodeFrame(framing, request, buffer);
+
+	if (exchangeEncoded(session, request, buffer, length, response, NULL)
+	    == -1)
+	{
+		return -1;
+	}
+
+	if (session->framing == framing
+	 || (*response)->type != VerificationError)
+	{
+		return 0;
+	}
+
+	deallocateFrame(*response);
+	*response = NULL;
+
+	PROBE3(frame_retry, session, session->output, request->type);
+	session->telemetry.retries++;
+	length = encodeFrame(session->framing, request, buffer);
+
+	return exchangeEncoded(session, request, buffer, length, response, NULL);
+}
+
+static int exchangeEncoded(struct Session *session, struct Frame *request,
+                           uint8_t *buffer, size_t length,
+                           struct Frame **response, struct Frame *storage)
+{
+	double start = measureTime();
+	double elapsed = 0;
+	uint32_t latency = 0;
+
+	if (transmit(session, buffer, length) == -1)
+	{
+		return -1;
+	}
+
+	if (awaitResponse(session, request, response, storage) == -1)
+	{
+		return -1;
+	}
+
+	elapsed = measureTime() - start;
+	latency = elapsed * 1000 + 1;
+	session->telemetry.frames++;
+	recordRoundTrip(&session->telemetry, elapsed);
+
+	if (latency > session->latency)
+	{
+		session->latency = latency;
+	}
+
+	if ((*response)->type == Acknowledgement)
+	{
+		PROBE3(acknowledgement, session, request->type, latency);
+	}
+
+	return 0;
+}
+
+static int awaitResponse(struct Session *session, struct Frame *request,
+                         struct Frame **response, struct Frame *storage)
+{
+	if (session->verbose)
+	{
+		traceFrame(request);
+	}
+
+	if (receiveResponse(session, response, storage) == -1)
+	{
+		return -1;
+	}
+
+	if (session->verbose)
+	{
+		traceFrame(*response);
+	}
+
+	return 0;
+}
+
+static int acknowledged(struct Session *session, struct Frame *request)
+{
+	struct Frame *response = NULL;
+
+	if (exchange(session, request, &response) == -1)
+	{
+		return -1;
+	}
+
+	return expectAcknowledgement(response);
+}
+
+static int expectAcknowledgement(struct Frame *response)
+{
+	if (response->type != Acknowledgement)
+	{
+		deallocateFrame(response);
+		return -1;
+	}
+
+	deallocateFrame(response);
+	return 0;
+}
+
+static int receiveResponse(struct Session *session, struct Frame **response,
+                           struct Frame *storage)
+{
+	size_t size = session->blockSize;
+	uint8_t *buffer = NULL;
+	int length = 0;
+
+	if (size < RECEIVE_MINIMUM_SIZE)
+	{
+		size = RECEIVE_MINIMUM_SIZE;
+	}
+
+	size = MAXIMUM_FRAME_SIZE(size);
+	buffer = reserveBuffer(session, &session->receiveBuffer, size);
+
+	if (buffer == NULL)
+	{
+		return -1;
+	}
+
+	if (receive(session, buffer, size, &length) == -1)
+	{
+		return -1;
+	}
+
+	if (storage)
+	{
+		*response = storage;
+		return recogniseFrameInPlace(&session->framing, buffer, length,
+		                             storage);
+	}
+
+	return recogniseFrame(&session->framing, buffer, length, response);
+}
+
+static int transmit(struct Session *session, uint8_t *buffer, size_t length)
+{
+	if (session->link == NULL)
+	{
+		fprintf(stderr, "Device not open\n\n");
+		return -1;
+	}
+
+	if (atomic_exchange(&session->cancelled, false))
+	{
+		fprintf(stderr, "Cancelled\n\n");
+		return -1;
+	}
+
+	if (session->verbose)
+	{
+		traceData(TraceTransmit, buffer, length);
+	}
+
+	return session->transport->transmit(session, buffer, length);
+}
+
+static int receive(struct Session *session,
+                   uint8_t *buffer, size_t size, int *length)
+{
+	if (session->link == NULL)
+	{
+		fprintf(stderr, "Device not open\n\n");
+		return -1;
+	}
+
+	if (session->transport->receive(session, buffer, size, length) == -1)
+	{
+		return -1;
+	}
+
+	if (session->verbose)
+	{
+		traceData(TraceReceive, buffer, *length);
+	}
+
+	return 0;
+}
+
+static uint8_t *reserveBuffer(struct Session *session,
+                              struct Buffer *buffer, size_t size)
+{
+	if (buffer->size >= size)
+	{
+		return buffer->data;
+	}
+
+	releaseBuffer(session, buffer);
+
+	if (session->transport->allocate)
+	{
+		buffer->data = session->transport->allocate(session, size,
+		                                            &buffer->mapped);
+	}
+
+	else
+	{
+		buffer->data = malloc(size);
+		buffer->mapped = false;
+	}
+
+	if (buffer->data == NULL)
+	{
+		ERROR(strerror(errno));
+		return NULL;
+	}
+
+	buffer->size = size;
+
+	if (session->realTime.enabled)
+	{
+		buffer->locked = lockMemory(buffer->data, size);
+		session->realTime.locked &= buffer->locked;
+	}
+
+	return buffer->data;
+}
+
+static void releaseBuffer(struct Session *session, struct Buffer *buffer)
+{
+	if (buffer->data == NULL)
+	{
+		return;
+	}
+
+	if (buffer->locked)
+	{
+		unlockMemory(buffer->data, buffer->size);
+	}
+
+	if (session->transport->release)
+	{
+		session->transport->release(session, buffer->data, buffer->size,
+		                            buffer->mapped);
+	}
+
+	else
+	{
+		free(buffer->data);
+	}
+
+	buffer->data = NULL;
+	buffer->size = 0;
+	buffer->mapped = false;
+	buffer->locked = false;
+}
+
+static uint8_t *allocatePipelineBuffer(void *context, size_t size)
+{
+	struct Session *session = context;
+	struct Buffer buffer = { 0 };
+
+	if (reserveBuffer(session, &buffer, size + BUFFER_HEADER_SIZE) == NULL)
+	{
+		return NULL;
+	}
+
+	buffer.data[0] = buffer.mapped;
+	buffer.data[1] = buffer.locked;
+	return buffer.data + BUFFER_HEADER_SIZE;
+}
+
+static void releasePipelineBuffer(void *context, uint8_t *data, size_t size)
+{
+	struct Session *session = context;
+	struct Buffer buffer =
+	{
+		.data   = data - BUFFER_HEADER_SIZE,
+		.size   = size + BUFFER_HEADER_SIZE,
+		.mapped = data[-BUFFER_HEADER_SIZE],
+		.locked = data[-BUFFER_HEADER_SIZE + 1]
+	};
+
+	releaseBuffer(session, &buffer);
+}
+
+static int openUSB(struct Session *session)
+{
+	int result = -1;
+
+	if (session->device)
+	{
+		result = libusb_open(session->device, &session->handle);
+
+		if (result < 0)
+		{
+			fprintf(stderr, "%s\n\n", libusb_strerror(result));
+			session->handle = NULL;
+			return -1;
+		}
+	}
+
+	else
+	{
+		session->handle = libusb_open_device_with_vid_pid(NULL,
+		                                                  session->vendor,
+		                                                  session->product);
+	}
+
+	if (session->handle == NULL)
+	{
+		fprintf(stderr, "Failed to open device\n\n");
+		return -1;
+	}
+
+	result = libusb_claim_interface(session->handle, session->interface);
+
+	if (result < 0)
+	{
+		fprintf(stderr, "%s\n\n", libusb_strerror(result));
+		libusb_close(session->handle);
+		session->handle = NULL;
+		return -1;
+	}
+
+	result = libusb_control_transfer(session->handle, 0x21, 34,
+	                                 session->output << 8 | 1, 0,
+	                                 NULL, 0, session->timeout);
+
+	if (result < 0)
+	{
+		fprintf(stderr, "%s\n\n", libusb_strerror(result));
+		libusb_release_interface(session->handle, 0);
+		libusb_close(session->handle);
+		session->handle = NULL;
+		return -1;
+	}
+
+	discoverTopology(session);
+	result = libusb_get_max_packet_size(libusb_get_device(session->handle),
+	                                    session->output);
+	session->packetSize = result > 0 ? result : 0;
+	session->link = session->handle;
+	holdDevice(libusb_get_device(session->handle));
+	return 0;
+}
+
+static void discoverTopology(struct Session *session)
+{
+	libusb_device *device = libusb_get_device(session->handle);
+	int depth = libusb_get_port_numbers(device, session->topology.ports,
+	                                    SCHEDULER_MAXIMUM_DEPTH);
+
+	session->topology.bus = libusb_get_bus_number(device);
+	session->topology.depth = depth > 0 ? depth : 0;
+
+	switch (libusb_get_device_speed(device))
+	{
+		case LIBUSB_SPEED_LOW:
+			session->topology.speed = LowSpeed;
+			break;
+
+		case LIBUSB_SPEED_FULL:
+			session->topology.speed = FullSpeed;
+			break;
+
+		case LIBUSB_SPEED_HIGH:
+			session->topology.speed = HighSpeed;
+			break;
+
+		case LIBUSB_SPEED_SUPER:
+			session->topology.speed = SuperSpeed;
+			break;
+
+		case LIBUSB_SPEED_SUPER_PLUS:
+			session->topology.speed = SuperSpeedPlus;
+			break;
+
+		default:
+			session->topology.speed = UnknownSpeed;
+			break;
+	}
+}
+
+static void closeUSB(struct Session *session)
+{
+	libusb_free_transfer(session->transmitTransfer);
+	libusb_free_transfer(session->receiveTransfer);
+	session->transmitTransfer = NULL;
+	session->receiveTransfer = NULL;
+
+	dropDevice(libusb_get_device(session->handle));
+	libusb_release_interface(session->handle, 0);
+	libusb_close(session->handle);
+	session->handle = NULL;
+	session->link = NULL;
+}
+
+static int transmitToUSB(struct Session *session,
+                         uint8_t *buffer, size_t length)
+{
+	int count = 0;
+
+	while (count < length)
+	{
+		int transferred = 0;
+
+		if (count > 0)
+		{
+			PROBE3(bulk_retry, session, session->output, length - count);
+		}
+
+		if (transferUSB(session, &session->transmitTransfer,
+		                session->output, buffer + count, length - count,
+		                &transferred) == -1)
+		{
+			return -1;
+		}
+
+		count += transferred;
+	}
+
+	return 0;
+}
+
+static int receiveFromUSB(struct Session *session,
+                          uint8_t *buffer, size_t size, int *length)
+{
+	return transferUSB(session, &session->receiveTransfer,
+	                   session->input, buffer, size, length);
+}
+
+static int transferUSB(struct Session *session,
+                       struct libusb_transfer **transfer,
+                       unsigned char endpoint, uint8_t *buffer, int length,
+                       int *transferred)
+{
+	int completed = 0;
+	int result = 0;
+	double start = 0;
+
+	if (*transfer == NULL)
+	{
+		*transfer = libusb_alloc_transfer(0);
+
+		if (*transfer == NULL)
+		{
+			ERROR("Failed to allocate transfer");
+			return -1;
+		}
+	}
+
+	libusb_fill_bulk_transfer(*transfer, session->handle, endpoint,
+	                          buffer, length, completeTransfer, &completed,
+	                          session->timeout);
+
+	pthread_mutex_lock(&session->lock);
+
+	if (atomic_exchange(&session->cancelled, false))
+	{
+		pthread_mutex_unlock(&session->lock);
+		fprintf(stderr, "Cancelled\n\n");
+		return -1;
+	}
+
+	if (PROBE_ENABLED(bulk_done))
+	{
+		start = measureTime();
+	}
+
+	PROBE3(bulk_start, session, endpoint, length);
+	result = libusb_submit_transfer(*transfer);
+
+	if (result == 0)
+	{
+		session->activeTransfer = *transfer;
+	}
+
+	pthread_mutex_unlock(&session->lock);
+
+	if (result < 0)
+	{
+		fprintf(stderr, "%s\n\n", libusb_strerror(result));
+		return -1;
+	}
+
+	while (!completed)
+	{
+		result = libusb_handle_events_completed(NULL, &completed);
+
+		if (result < 0 && result != LIBUSB_ERROR_INTERRUPTED)
+		{
+			libusb_cancel_transfer(*transfer);
+		}
+	}
+
+	pthread_mutex_lock(&session->lock);
+	session->activeTransfer = NULL;
+	pthread_mutex_unlock(&session->lock);
+
+	if (PROBE_ENABLED(bulk_done))
+	{
+		PROBE4(bulk_done, endpoint, (*transfer)->status,
+		       (*transfer)->actual_length,
+		       (uint32_t)((measureTime() - start) * 1e6));
+	}
+
+	switch ((*transfer)->status)
+	{
+		case LIBUSB_TRANSFER_COMPLETED:
+			*transferred = (*transfer)->actual_length;
+			return 0;
+
+		case LIBUSB_TRANSFER_TIMED_OUT:
+			fprintf(stderr, "Operation timed out\n\n");
+			break;
+
+		case LIBUSB_TRANSFER_CANCELLED:
+			atomic_store(&session->cancelled, false);
+			fprintf(stderr, "Cancelled\n\n");
+			break;
+
+		case LIBUSB_TRANSFER_NO_DEVICE:
+			fprintf(stderr, "No such device\n\n");
+			break;
+
+		default:
+			fprintf(stderr, "Transfer failed\n\n");
+			break;
+	}
+
+	return -1;
+}
+
+static void LIBUSB_CALL completeTransfer(struct libusb_transfer *transfer)
+{
+	int *completed = transfer->user_data;
+
+	*completed = 1;
+}
+
+static uint8_t *allocateUSBBuffer(struct Session *session,
+                                  size_t size, bool *mapped)
+{
+	uint8_t *buffer = libusb_dev_mem_alloc(session->handle, size);
+
+	*mapped = buffer != NULL;
+
+	if (buffer == NULL)
+	{
+		buffer = malloc(size);
+	}
+
+	else
+	{
+		session->zeroCopy = true;
+	}
+
+	return buffer;
+}
+
+static void releaseUSBBuffer(struct Session *session,
+                             uint8_t *buffer, size_t size, bool mapped)
+{
+	if (mapped)
+	{
+		libusb_dev_mem_free(session->handle, buffer, size);
+	}
+
+	else
+	{
+		free(buffer);
+	}
+}
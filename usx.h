@@ -0,0 +1,176 @@
+#ifndef USX_H
+#define USX_H
+
+#include <libusb-1.0/libusb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "boot.h"
+#include "capability.h"
+#include "erase.h"
+#include "frame.h"
+#include "realtime.h"
+#include "scheduler.h"
+#include "telemetry.h"
+
+#define RECEIVE_MINIMUM_SIZE 4096
+#define BUFFER_HEADER_SIZE 64
+#define SESSION_DEFAULT_TIMEOUT 3000
+
+struct Image;
+struct Segment;
+struct Serial;
+struct Session;
+struct Simulator;
+
+struct Transport
+{
+	int (*open)(struct Session *session);
+	void (*close)(struct Session *session);
+	int (*transmit)(struct Session *session, uint8_t *buffer, size_t length);
+	int (*receive)(struct Session *session,
+	               uint8_t *buffer, size_t size, int *length);
+	uint8_t *(*allocate)(struct Session *session, size_t size, bool *mapped);
+	void (*release)(struct Session *session,
+	                uint8_t *buffer, size_t size, bool mapped);
+};
+
+struct Buffer
+{
+	uint8_t *data;
+	size_t size;
+	bool mapped;
+	bool locked;
+};
+
+struct Session
+{
+	const struct Transport *transport;
+	void *link;
+
+	libusb_device *device;
+	libusb_device_handle *handle;
+	struct libusb_transfer *transmitTransfer;
+	struct libusb_transfer *receiveTransfer;
+	struct libusb_transfer *activeTransfer;
+	struct Simulator *simulator;
+	struct Serial *serial;
+
+	pthread_mutex_t lock;
+	atomic_bool cancelled;
+
+	struct Buffer transmitBuffer;
+	struct Buffer receiveBuffer;
+	bool zeroCopy;
+
+	uint16_t vendor;
+	uint16_t product;
+	uint16_t interface;
+	uint16_t input;
+	uint16_t output;
+	uint16_t packetSize;
+	struct Topology topology;
+	struct Scheduler *scheduler;
+
+	uint32_t timeout;
+	uint16_t blockSize;
+	unsigned workers;
+	enum Framing framing;
+	bool packing;
+	bool erasing;
+	bool verifying;
+	struct RealTime realTime;
+	struct Geometry geometry;
+	bool geometryQueried;
+	struct EraseMap erased;
+	struct Capabilities capabilities;
+	uint32_t latency;
+	double throughput;
+	uint32_t packets;
+	uint64_t wireBytes;
+	uint32_t erasures;
+	uint64_t erasedBytes;
+	uint64_t verifiedBytes;
+	uint32_t rewrites;
+	struct Gaps gaps;
+	struct Telemetry telemetry;
+	bool verbose;
+
+	void (*progress)(void *context, uint32_t done, uint32_t total);
+	void *progressContext;
+};
+
+struct Region
+{
+	char *filename;
+	uint32_t offset;
+	uint32_t length;
+	uint32_t address;
+
+	unsigned transfer;
+	double elapsed;
+	bool sent;
+};
+
+struct Delivery
+{
+	struct Session *session;
+	int result;
+	bool evicted;
+	uint32_t shared;
+	double elapsed;
+};
+
+struct Probe
+{
+	uint16_t blockSize;
+	uint32_t frames;
+	uint32_t errors;
+	double throughput;
+};
+
+extern const struct Transport USBTransport;
+
+int usxInitialise(void);
+void usxCleanup(void);
+
+struct Session *usxCreateSession(void);
+void usxDestroySession(struct Session *session);
+
+int usxOpen(struct Session *session);
+int usxClose(struct Session *session);
+int usxAwait(struct Session *session, uint32_t timeout,
+             struct Frame **banner, double *elapsed);
+int usxArrive(struct Session *session, uint32_t delay,
+              uint16_t maximumPayload, struct Topology *topology);
+int usxGreet(struct Session *session, struct Frame **banner);
+int usxConnect(struct Session *session);
+int usxQueryGeometry(struct Session *session);
+int usxReset(struct Session *session);
+int usxSend(struct Session *session, char *filename, uint32_t address);
+int usxSendImage(struct Session *session, struct Image *image,
+                 uint32_t address);
+struct Segment *usxOpenRegions(struct Region *regions, size_t count);
+void usxCloseRegions(struct Segment *segments, size_t count);
+int usxSendRegions(struct Session *session, struct Region *regions,
+                   struct Segment *segments, size_t count,
+                   unsigned *transfers);
+int usxBroadcast(struct Delivery *deliveries, size_t count,
+                 char *filename, uint32_t address);
+int usxErase(struct Session *session, uint32_t address, uint32_t size);
+int usxExecute(struct Session *session);
+int usxBoot(struct Session *session,
+            const struct BootStage *stages, size_t count);
+void usxCancel(struct Session *session);
+int usxDump(struct Session *session, char *filename,
+            uint32_t address, uint32_t size);
+int usxTune(struct Session *session, uint32_t address, uint16_t limit,
+            struct Probe *probes, size_t *count);
+int usxSerial(struct Session *session, char *path, uint32_t baud);
+int usxSimulate(struct Session *session, uint16_t maximumPayload,
+                struct Topology *topology);
+
+#endif